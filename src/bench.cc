@@ -0,0 +1,300 @@
+// Microbenchmarks of the marshalling helpers of tokyocabinet.cc, which
+// convert arguments and results between V8 and Tokyo Cabinet without any
+// database I/O. Built as build/default/tcbench.node by
+// "node-waf configure --bench build" and run by test/microbench.js.
+//
+// The binding is compiled into this module with the allocating functions
+// of tcutil counted, so each case reports ns/op, allocations/op made by
+// the binding (not those inside Tokyo Cabinet or V8) and bytes/op of the
+// V8 heap.
+
+#include <node.h>
+#include <node_buffer.h>
+#include <node_events.h>
+#include <tcutil.h>
+#include <tchdb.h>
+#include <tcbdb.h>
+#include <tcfdb.h>
+#include <tctdb.h>
+#include <tcadb.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+static unsigned long allocs = 0;
+
+#define tcmalloc(size) (allocs++, tcmalloc(size))
+#define tccalloc(nmemb, size) (allocs++, tccalloc(nmemb, size))
+#define tcmemdup(ptr, size) (allocs++, tcmemdup(ptr, size))
+#define tcstrdup(str) (allocs++, tcstrdup(str))
+#define tclistnew() (allocs++, tclistnew())
+#define tclistnew2(anum) (allocs++, tclistnew2(anum))
+#define tcmapnew() (allocs++, tcmapnew())
+#define tcmapnew2(bnum) (allocs++, tcmapnew2(bnum))
+#define tcptrlistnew() (allocs++, tcptrlistnew())
+#define tcptrlistnew2(anum) (allocs++, tcptrlistnew2(anum))
+#define tcxstrnew() (allocs++, tcxstrnew())
+
+// the module is initialized by init below
+#define init tokyocabinet_init
+#include "tokyocabinet.cc"
+#undef init
+
+// number of elements of lists and columns of records in the cases
+static const int LISTNUM = 100;
+static const int COLNUM = 10;
+
+class Bench : public HDB {
+  private:
+    typedef void (*Op)();
+
+    static Persistent<Object> db;
+    static Persistent<Array> keys;
+    static Persistent<Object> rec;
+    static Persistent<String> asciikey;
+    static Persistent<String> utf8key;
+    static Persistent<Function> nop;
+    static Persistent<Function> putdata;
+    static Persistent<Function> putasyncdata;
+    static Persistent<Function> getmanydata;
+    static Handle<Value> argv[3];
+    static TCLIST *list;
+    static TCMAP *map;
+    static Colnames *names;
+
+    static double
+    now () {
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+    }
+
+    static size_t
+    heapused () {
+      HeapStatistics hs;
+      V8::GetHeapStatistics(&hs);
+      return hs.used_heap_size();
+    }
+
+    /* Runs op iter times in rounds of 64. Rounds in which a GC shrank the
+     * heap are left out of the heap bytes. */
+    static Local<Object>
+    measure (const char *name, Op op, int iter) {
+      HandleScope scope;
+      const int round = 64;
+      op(); // warm up
+      unsigned long start_allocs = allocs;
+      double heap = 0;
+      int heapiter = 0;
+      double start = now();
+      for (int i = 0; i < iter; i += round) {
+        size_t used = heapused();
+        for (int j = 0; j < round; j++) {
+          HandleScope scope;
+          op();
+        }
+        size_t after = heapused();
+        if (after >= used) {
+          heap += after - used;
+          heapiter += round;
+        }
+      }
+      double elapsed = now() - start;
+      int done = (iter + round - 1) / round * round;
+      Local<Object> res = Object::New();
+      res->Set(String::NewSymbol("name"), String::New(name));
+      res->Set(String::NewSymbol("ns"), Number::New(elapsed / done));
+      res->Set(String::NewSymbol("allocs"),
+               Number::New(static_cast<double>(allocs - start_allocs) / done));
+      res->Set(String::NewSymbol("heap"),
+               Number::New(heapiter > 0 ? heap / heapiter : 0));
+      return scope.Close(res);
+    }
+
+    static void
+    Arytotclist () {
+      tclistdel(arytotclist(keys));
+    }
+
+    static void
+    Tclisttoary () {
+      tclisttoary(list);
+    }
+
+    static void
+    Tclisttopacked () {
+      tclisttopacked(list);
+    }
+
+    static void
+    Objtotcmap () {
+      tcmapdel(objtotcmap(rec));
+    }
+
+    static void
+    Tcmaptoobj () {
+      tcmaptoobj(map);
+    }
+
+    static void
+    Tcmaptoobjnames () {
+      tcmaptoobj(map, names);
+    }
+
+    static void
+    Asciikey () {
+      ByteValue key(asciikey);
+    }
+
+    static void
+    Utf8key () {
+      ByteValue key(utf8key);
+    }
+
+    // a call of an empty native method, to subtract from the Data cases
+    static void
+    Call () {
+      nop->Call(db, 2, argv);
+    }
+
+    static void
+    Putdata () {
+      putdata->Call(db, 2, argv);
+    }
+
+    static void
+    Putasyncdata () {
+      putasyncdata->Call(db, 3, argv);
+    }
+
+    static void
+    Getmanydata () {
+      getmanydata->Call(db, 1, argv + 2);
+    }
+
+    static Handle<Value>
+    Nop (const Arguments& args) {
+      return Undefined();
+    }
+
+    static Handle<Value>
+    NewPutData (const Arguments& args) {
+      HandleScope scope;
+      PutData data(args);
+      return Undefined();
+    }
+
+    static Handle<Value>
+    NewPutAsyncData (const Arguments& args) {
+      HandleScope scope;
+      delete new PutAsyncData(args);
+      return Undefined();
+    }
+
+    static Handle<Value>
+    NewGetmanyData (const Arguments& args) {
+      HandleScope scope;
+      GetmanyData data(args);
+      return Undefined();
+    }
+
+    static Local<Function>
+    Method (InvocationCallback cb) {
+      return FunctionTemplate::New(cb)->GetFunction();
+    }
+
+    static void
+    Setup (const Handle<Object> target) {
+      HandleScope scope;
+      char buf[32];
+      keys = Persistent<Array>::New(Array::New(LISTNUM));
+      list = tclistnew2(LISTNUM);
+      for (int i = 0; i < LISTNUM; i++) {
+        int len = sprintf(buf, "key%08d", i);
+        keys->Set(i, String::New(buf, len));
+        tclistpush(list, buf, len);
+      }
+      rec = Persistent<Object>::New(Object::New());
+      map = tcmapnew2(COLNUM);
+      for (int i = 0; i < COLNUM; i++) {
+        int len = sprintf(buf, "column%d", i);
+        rec->Set(String::New(buf, len), String::New("0123456789abcdef"));
+        tcmapput(map, buf, len, "0123456789abcdef", 16);
+      }
+      names = new Colnames;
+      asciikey = Persistent<String>::New(String::New("user4f2a9c1e8b7d3605"));
+      utf8key = Persistent<String>::New(String::New("\xe3\x83\xa6\xe3\x83\xbc"
+                                                    "\xe3\x82\xb6\xe3\x83\xbc"
+                                                    "4f2a9c1e8b7d"));
+      Local<Function> ctor =
+        Local<Function>::Cast(target->Get(String::New("HDB")));
+      db = Persistent<Object>::New(ctor->NewInstance());
+      nop = Persistent<Function>::New(Method(Nop));
+      putdata = Persistent<Function>::New(Method(NewPutData));
+      putasyncdata = Persistent<Function>::New(Method(NewPutAsyncData));
+      getmanydata = Persistent<Function>::New(Method(NewGetmanyData));
+      argv[0] = Persistent<String>::New(asciikey);
+      argv[1] = Persistent<String>::New(String::New("0123456789abcdef"));
+      argv[2] = Persistent<Array>::New(keys);
+    }
+
+  public:
+    // run([iterations]) => [{name, ns, allocs, heap}, ...]
+    static Handle<Value>
+    Run (const Arguments& args) {
+      HandleScope scope;
+      int iter = args[0]->IsNumber() ? args[0]->Int32Value() : 100000;
+      if (iter < 1) return THROW_BAD_ARGS;
+      struct {
+        const char *name;
+        Op op;
+        int div; // fewer iterations for cases of whole lists
+      } cases[] = {
+        {"arytotclist 100 keys", Arytotclist, 10},
+        {"tclisttoary 100 keys", Tclisttoary, 10},
+        {"tclisttopacked 100 keys", Tclisttopacked, 10},
+        {"objtotcmap 10 columns", Objtotcmap, 1},
+        {"tcmaptoobj 10 columns", Tcmaptoobj, 1},
+        {"tcmaptoobj 10 columns, names cached", Tcmaptoobjnames, 1},
+        {"ByteValue ASCII key", Asciikey, 1},
+        {"ByteValue UTF-8 key", Utf8key, 1},
+        {"native call (baseline)", Call, 1},
+        {"PutData via call", Putdata, 1},
+        {"PutAsyncData via call", Putasyncdata, 1},
+        {"GetmanyData 100 keys via call", Getmanydata, 10}
+      };
+      int num = sizeof(cases) / sizeof(cases[0]);
+      Local<Array> res = Array::New(num);
+      for (int i = 0; i < num; i++) {
+        int n = iter / cases[i].div;
+        res->Set(i, measure(cases[i].name, cases[i].op, n > 0 ? n : 1));
+      }
+      return scope.Close(res);
+    }
+
+    static void
+    Initialize (const Handle<Object> target) {
+      Setup(target);
+      NODE_SET_METHOD(target, "run", Run);
+    }
+};
+
+Persistent<Object> Bench::db;
+Persistent<Array> Bench::keys;
+Persistent<Object> Bench::rec;
+Persistent<String> Bench::asciikey;
+Persistent<String> Bench::utf8key;
+Persistent<Function> Bench::nop;
+Persistent<Function> Bench::putdata;
+Persistent<Function> Bench::putasyncdata;
+Persistent<Function> Bench::getmanydata;
+Handle<Value> Bench::argv[3];
+TCLIST *Bench::list;
+TCMAP *Bench::map;
+Colnames *Bench::names;
+
+extern "C" void
+init (Handle<Object> target) {
+  HandleScope scope;
+  tokyocabinet_init(target);
+  Bench::Initialize(target);
+}
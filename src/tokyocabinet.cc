@@ -1,4 +1,6 @@
 #include <node.h>
+#include <node_buffer.h>
+#include <node_events.h>
 #include <tcutil.h>
 #include <tchdb.h>
 #include <tcbdb.h>
@@ -8,7 +10,21 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <ctype.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+    (defined(__clang__) || __GNUC__ > 4 || \
+     (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define TC_ASCII_AVX2
+#include <immintrin.h>
+#endif
 
 #define THROW_BAD_ARGS \
   ThrowException(Exception::TypeError(String::New("Bad arguments")))
@@ -25,31 +41,321 @@
 using namespace v8;
 using namespace node;
 
+// ASCII detection and narrowing of UTF-16 to ASCII, which are the fast
+// paths of transcoding keys and values. The kernels are chosen at load
+// time: AVX2 if the CPU has it, else SSE2 (always there on x86-64), else
+// a scalar loop that tests a word at a time.
+struct AsciiKernels {
+  // true if no byte of buf has the high bit set
+  bool (*scan)(const char *buf, int siz);
+  // copies src to dst as bytes, false (dst undefined) if not all ASCII
+  bool (*narrow)(const uint16_t *src, char *dst, int len);
+};
+
+static bool asciiscan_scalar (const char *buf, int siz) {
+  int i = 0;
+  for (; i + 8 <= siz; i += 8) {
+    uint64_t w;
+    memcpy(&w, buf + i, 8);
+    if (w & 0x8080808080808080ULL) return false;
+  }
+  for (; i < siz; i++) {
+    if (buf[i] & 0x80) return false;
+  }
+  return true;
+}
+
+static bool asciinarrow_scalar (const uint16_t *src, char *dst, int len) {
+  uint16_t acc = 0;
+  for (int i = 0; i < len; i++) {
+    acc |= src[i];
+    dst[i] = static_cast<char>(src[i]);
+  }
+  return acc < 0x80;
+}
+
+#ifdef __SSE2__
+static bool asciiscan_sse2 (const char *buf, int siz) {
+  int i = 0;
+  for (; i + 16 <= siz; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + i));
+    if (_mm_movemask_epi8(v)) return false;
+  }
+  return asciiscan_scalar(buf + i, siz - i);
+}
+
+static bool asciinarrow_sse2 (const uint16_t *src, char *dst, int len) {
+  const __m128i high = _mm_set1_epi16(static_cast<short>(0xff80));
+  int i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i b =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+    __m128i hi = _mm_and_si128(_mm_or_si128(a, b), high);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(hi, _mm_setzero_si128())) !=
+        0xffff) return false;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                     _mm_packus_epi16(a, b));
+  }
+  return asciinarrow_scalar(src + i, dst + i, len - i);
+}
+#endif
+
+#ifdef TC_ASCII_AVX2
+__attribute__((target("avx2")))
+static bool asciiscan_avx2 (const char *buf, int siz) {
+  int i = 0;
+  for (; i + 32 <= siz; i += 32) {
+    __m256i v =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buf + i));
+    if (_mm256_movemask_epi8(v)) return false;
+  }
+  return asciiscan_sse2(buf + i, siz - i);
+}
+
+__attribute__((target("avx2")))
+static bool asciinarrow_avx2 (const uint16_t *src, char *dst, int len) {
+  const __m256i high = _mm256_set1_epi16(static_cast<short>(0xff80));
+  int i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i a =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m256i b =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 16));
+    if (!_mm256_testz_si256(_mm256_or_si256(a, b), high)) return false;
+    // packus works within 128-bit lanes, so put the quarters back in order
+    __m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), p);
+  }
+  return asciinarrow_sse2(src + i, dst + i, len - i);
+}
+#endif
+
+static AsciiKernels pickascii () {
+  AsciiKernels k = { asciiscan_scalar, asciinarrow_scalar };
+#ifdef __SSE2__
+  k.scan = asciiscan_sse2;
+  k.narrow = asciinarrow_sse2;
+#endif
+#ifdef TC_ASCII_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    k.scan = asciiscan_avx2;
+    k.narrow = asciinarrow_avx2;
+  }
+#endif
+  return k;
+}
+
+static const AsciiKernels ascii = pickascii();
+
+inline bool isasciibuf (const char *buf, int siz) {
+  return ascii.scan(buf, siz);
+}
+
+// String to UTF-8 in a buffer allocated with tcmalloc. Short strings are
+// read as UTF-16 and narrowed in one vectorized pass when they are ASCII,
+// which is the common case for keys; others are measured and encoded.
+static const int ASCIIMAX = 256;
+
+inline char *strtobytes (const Handle<String> str, int *sp) {
+  int len = str->Length();
+  if (len <= ASCIIMAX) {
+    uint16_t wbuf[ASCIIMAX];
+    str->Write(wbuf, 0, len);
+    char *buf = static_cast<char *>(tcmalloc(len + 1));
+    if (ascii.narrow(wbuf, buf, len)) {
+      buf[len] = '\0';
+      *sp = len;
+      return buf;
+    }
+    tcfree(buf);
+  }
+  int siz = str->Utf8Length();
+  char *buf = static_cast<char *>(tcmalloc(siz + 1));
+  str->WriteUtf8(buf);
+  *sp = siz;
+  return buf;
+}
+
+// Key or value given from JavaScript as a byte sequence.
+// Strings are copied as UTF-8, while Buffers are passed to Tokyo Cabinet
+// in place (the Buffer is kept alive until this object is destroyed).
+class ByteValue {
+  private:
+    char *buf;
+    int siz;
+    Persistent<Object> buffer;
+
+  public:
+    ByteValue (const Handle<Value> val) {
+      HandleScope scope;
+      if (Buffer::HasInstance(val)) {
+        Local<Object> obj = val->ToObject();
+        Buffer *b = ObjectWrap::Unwrap<Buffer>(obj);
+        buf = b->data();
+        siz = b->length();
+        buffer = Persistent<Object>::New(obj);
+      } else {
+        buf = strtobytes(val->ToString(), &siz);
+      }
+    }
+
+    ~ByteValue () {
+      if (buffer.IsEmpty()) {
+        tcfree(buf);
+      } else {
+        buffer.Dispose();
+      }
+    }
+
+    char *
+    operator* () {
+      return buf;
+    }
+
+    int
+    length () {
+      return siz;
+    }
+};
+
+// byte sequence from Tokyo Cabinet to Buffer (if binary) or String
+inline Local<Value> bytestoval (const char *buf, int siz, bool binary) {
+  HandleScope scope;
+  if (binary) {
+    Buffer *b = Buffer::New(siz);
+    memcpy(b->data(), buf, siz);
+    return scope.Close(Local<Object>::New(b->handle_));
+  }
+  return scope.Close(String::New(buf, siz));
+}
+
+// Value adopted by an external string, freed when the string is collected
+class ExternalValue : public String::ExternalAsciiStringResource {
+  private:
+    char *buf;
+    size_t siz;
+
+  public:
+    ExternalValue (char *buf_, size_t siz_) : buf(buf_), siz(siz_) {
+      V8::AdjustAmountOfExternalAllocatedMemory(siz);
+    }
+
+    ~ExternalValue () {
+      tcfree(buf);
+      V8::AdjustAmountOfExternalAllocatedMemory(-static_cast<int>(siz));
+    }
+
+    const char *
+    data () const {
+      return buf;
+    }
+
+    size_t
+    length () const {
+      return siz;
+    }
+};
+
+inline void freevalue (char *data, void *hint) {
+  tcfree(data);
+}
+
+// Value from Tokyo Cabinet to Buffer or String. Values of threshold bytes
+// or more are adopted without copying (see setexternal), and then *vbuf_p
+// is set to NULL as the caller no longer owns it. External strings are
+// Latin-1, so only ASCII values can be adopted as strings.
+inline Local<Value> takeval (char **vbuf_p, int vsiz, bool binary,
+                             int threshold) {
+  HandleScope scope;
+  char *vbuf = *vbuf_p;
+  if (threshold > 0 && vsiz >= threshold) {
+    if (binary) {
+      Buffer *b = Buffer::New(vbuf, vsiz, freevalue, NULL);
+      *vbuf_p = NULL;
+      return scope.Close(Local<Object>::New(b->handle_));
+    }
+    if (isasciibuf(vbuf, vsiz)) {
+      *vbuf_p = NULL;
+      return scope.Close(String::NewExternal(new ExternalValue(vbuf, vsiz)));
+    }
+  }
+  return scope.Close(bytestoval(vbuf, vsiz, binary));
+}
+
 // conversion between Tokyo Cabinet list/map to V8 Arrya/Object and vice versa
+// Elements are accessed by uint32_t indexes rather than boxed Integers,
+// and strings are encoded straight into the buffer owned by the list.
 inline TCLIST* arytotclist (const Handle<Array> ary) {
   HandleScope scope;
   int len = ary->Length();
-  TCLIST *list = tclistnew2(len);
-  Handle<Value> val;
+  TCLIST *list = tclistnew2(len > 0 ? len : 1);
+  Local<Value> val;
   for (int i = 0; i < len; i++) {
-    val = ary->Get(Integer::New(i));
-    if (val->IsString()) {
-      tclistpush2(list, *String::Utf8Value(val));
+    val = ary->Get(i);
+    if (Buffer::HasInstance(val)) {
+      Buffer *b = ObjectWrap::Unwrap<Buffer>(val->ToObject());
+      tclistpush(list, b->data(), b->length());
+    } else if (val->IsString() || val->IsNumber()) {
+      int siz;
+      char *buf = strtobytes(val->ToString(), &siz);
+      tclistpushmalloc(list, buf, siz);
     }
   }
   return list;
 }
 
-inline Local<Array> tclisttoary (TCLIST *list) {
+inline Local<Array> tclisttoary (TCLIST *list, bool binary = false) {
   HandleScope scope;
+  const char *vbuf;
+  int vsiz;
   int len = tclistnum(list);
   Local<Array> ary = Array::New(len);
   for (int i = 0; i < len; i++) {
-    ary->Set(Integer::New(i), String::New(tclistval2(list, i)));
+    vbuf = static_cast<const char*>(tclistval(list, i, &vsiz));
+    ary->Set(i, binary ? bytestoval(vbuf, vsiz, true) :
+                         Local<Value>(String::New(vbuf, vsiz)));
   }
   return scope.Close(ary);
 }
 
+// TCLIST as one Buffer of the elements concatenated and an Array of
+// offsets, where element i is from offsets[i] to offsets[i + 1]
+inline Local<Array> tclisttopacked (TCLIST *list) {
+  HandleScope scope;
+  const char *vbuf;
+  int vsiz;
+  int len = tclistnum(list);
+  int total = 0;
+  for (int i = 0; i < len; i++) {
+    tclistval(list, i, &vsiz);
+    total += vsiz;
+  }
+  Buffer *data = Buffer::New(total);
+  Local<Array> offsets = Array::New(len + 1);
+  char *wp = data->data();
+  int off = 0;
+  for (int i = 0; i < len; i++) {
+    vbuf = static_cast<const char*>(tclistval(list, i, &vsiz));
+    memcpy(wp + off, vbuf, vsiz);
+    offsets->Set(i, Integer::New(off));
+    off += vsiz;
+  }
+  offsets->Set(len, Integer::New(off));
+  Local<Array> ary = Array::New(2);
+  ary->Set(0, Local<Object>::New(data->handle_));
+  ary->Set(1, offsets);
+  return scope.Close(ary);
+}
+
+// list returned by a method (packed with setpacked)
+inline Local<Value> tclisttoval (TCLIST *list, bool binary, bool packed) {
+  HandleScope scope;
+  if (packed) return scope.Close(tclisttopacked(list));
+  return scope.Close(tclisttoary(list, binary));
+}
+
 inline TCMAP* objtotcmap (const Handle<Object> obj) {
   HandleScope scope;
   TCMAP *map = tcmapnew2(31);
@@ -57,17 +363,67 @@ inline TCMAP* objtotcmap (const Handle<Object> obj) {
   int len = keys->Length();
   Local<Value> key, val;
   for (int i = 0; i < len; i++) {
-    key = keys->Get(Integer::New(i));
+    key = keys->Get(i);
     val = obj->Get(key);
     if (NOU(val)) continue;
-    String::Utf8Value u8key(key);
-    String::Utf8Value u8val(val);
-    tcmapput(map, *u8key, u8key.length(), *u8val, u8val.length());
+    ByteValue bkey(key);
+    ByteValue bval(val);
+    tcmapput(map, *bkey, bkey.length(), *bval, bval.length());
   }
   return map;
 }
 
-inline Local<Object> tcmaptoobj (TCMAP *map) {
+// Column names of a table database as V8 symbols, so that the name of a
+// column is converted only once and not for every record. Records with the
+// same columns in the same order then also share their hidden class.
+class Colnames {
+  private:
+    // name -> index in syms
+    TCMAP *idxs;
+    Persistent<String> *syms;
+    int num;
+    int cap;
+
+  public:
+    // no more names are cached for schemaless tables
+    static const int MAXNUM = 4096;
+
+    Colnames () : num(0), cap(16) {
+      idxs = tcmapnew();
+      syms = static_cast<Persistent<String> *>(
+          tcmalloc(sizeof(*syms) * cap));
+    }
+
+    ~Colnames () {
+      for (int i = 0; i < num; i++) syms[i].Dispose();
+      tcfree(syms);
+      tcmapdel(idxs);
+    }
+
+    Handle<String>
+    get (const char *buf, int siz) {
+      int vsiz, idx;
+      const void *vbuf = tcmapget(idxs, buf, siz, &vsiz);
+      if (vbuf != NULL) {
+        memcpy(&idx, vbuf, sizeof(idx));
+        return syms[idx];
+      }
+      Local<String> sym = String::NewSymbol(buf, siz);
+      if (num < MAXNUM) {
+        if (num >= cap) {
+          cap *= 2;
+          syms = static_cast<Persistent<String> *>(
+              tcrealloc(syms, sizeof(*syms) * cap));
+        }
+        syms[num] = Persistent<String>::New(sym);
+        tcmapput(idxs, buf, siz, &num, sizeof(num));
+        num++;
+      }
+      return sym;
+    }
+};
+
+inline Local<Object> tcmaptoobj (TCMAP *map, Colnames *names = NULL) {
   HandleScope scope;
   const char *kbuf, *vbuf;
   int ksiz, vsiz;
@@ -77,11 +433,55 @@ inline Local<Object> tcmaptoobj (TCMAP *map) {
     kbuf = static_cast<const char*>(tcmapiternext(map, &ksiz));
     if (kbuf == NULL) break;
     vbuf = static_cast<const char*>(tcmapiterval(kbuf, &vsiz));
-    obj->Set(String::New(kbuf, ksiz), String::New(vbuf, vsiz));
+    obj->Set(names == NULL ? Handle<String>(String::NewSymbol(kbuf, ksiz)) :
+                             names->get(kbuf, ksiz),
+             String::New(vbuf, vsiz));
   }
   return scope.Close(obj);
 }
 
+// Array of [key, value] Arrays
+inline bool ispairary (const Handle<Value> val) {
+  HandleScope scope;
+  if (!val->IsArray()) return false;
+  Local<Array> ary = Local<Array>::Cast(val);
+  int len = ary->Length();
+  for (int i = 0; i < len; i++) {
+    if (!ary->Get(i)->IsArray()) return false;
+  }
+  return true;
+}
+
+// boolean option like {tx: true} of batch methods
+inline bool optbool (const Handle<Value> opts, const char *name) {
+  HandleScope scope;
+  return opts->IsObject() &&
+    opts->ToObject()->Get(String::NewSymbol(name))->BooleanValue();
+}
+
+// {columns: [...]} in options of TDB methods (NULL for all the columns)
+inline TCLIST* optcolumns (const Handle<Value> opts) {
+  HandleScope scope;
+  if (!opts->IsObject()) return NULL;
+  Local<Value> cols = opts->ToObject()->Get(String::NewSymbol("columns"));
+  return cols->IsArray() ? arytotclist(Local<Array>::Cast(cols)) : NULL;
+}
+
+// the given columns of a record (the map of the record is deleted)
+inline TCMAP* tcmapproject (TCMAP *map, const TCLIST *cols) {
+  int cnum = tclistnum(cols);
+  TCMAP *pmap = tcmapnew2(cnum + 1);
+  const char *cbuf, *vbuf;
+  int csiz, vsiz;
+  for (int i = 0; i < cnum; i++) {
+    cbuf = static_cast<const char *>(tclistval(cols, i, &csiz));
+    vbuf = static_cast<const char *>(tcmapget(map, cbuf, csiz, &vsiz));
+    if (vbuf != NULL) tcmapput(pmap, cbuf, csiz, vbuf, vsiz);
+  }
+  tcmapdel(map);
+  return pmap;
+}
+
 /* sync method blueprint */
 #define DEFINE_SYNC(name)                                                     \
   static Handle<Value>                                                        \
@@ -107,7 +507,7 @@ inline Local<Object> tcmaptoobj (TCMAP *map) {
   }                                                                           \
 
 /* async method blueprint */
-#define DEFINE_ASYNC_FUNC(name)                                               \
+#define DEFINE_ASYNC_SUBMIT(name, reader)                                     \
   static Handle<Value>                                                        \
   name##Async (const Arguments& args) {                                       \
     HandleScope scope;                                                        \
@@ -115,16 +515,25 @@ inline Local<Object> tcmaptoobj (TCMAP *map) {
       return THROW_BAD_ARGS;                                                  \
     }                                                                         \
     name##AsyncData *data = new name##AsyncData(args);                        \
-    eio_custom(Exec##name, EIO_PRI_DEFAULT, After##name, data);               \
+    Submit(THIS, Exec##name, After##name, data, reader);                      \
     ev_ref(EV_DEFAULT_UC);                                                    \
     return Undefined();                                                       \
   }                                                                           \
 
+#define DEFINE_ASYNC_FUNC(name)                                               \
+  DEFINE_ASYNC_SUBMIT(name, false)                                            \
+
+/* when the method only reads the database (see TCWrap::Dispatch) */
+#define DEFINE_ASYNC_READ_FUNC(name)                                          \
+  DEFINE_ASYNC_SUBMIT(name, true)                                             \
+
 #define DEFINE_ASYNC_EXEC(name)                                               \
   static int                                                                  \
   Exec##name (eio_req *req) {                                                 \
     name##AsyncData *data = static_cast<name##AsyncData *>(req->data);        \
+    data->started = nowns();                                                  \
     req->result = data->run() ? TCESUCCESS : data->ecode();                   \
+    data->finished = nowns();                                                 \
     return 0;                                                                 \
   }                                                                           \
 
@@ -133,6 +542,7 @@ inline Local<Object> tcmaptoobj (TCMAP *map) {
   After##name (eio_req *req) {                                                \
     HandleScope scope;                                                        \
     name##AsyncData *data = static_cast<name##AsyncData *>(req->data);        \
+    data->record(#name);                                                      \
     if (data->hasCallback) {                                                  \
       data->callCallback(Integer::New(req->result));                          \
     }                                                                         \
@@ -147,6 +557,7 @@ inline Local<Object> tcmaptoobj (TCMAP *map) {
   After##name (eio_req *req) {                                                \
     HandleScope scope;                                                        \
     name##AsyncData *data = static_cast<name##AsyncData *>(req->data);        \
+    data->record(#name);                                                      \
     if (data->hasCallback) {                                                  \
       data->callCallback(Integer::New(req->result), data->returnValue());     \
     }                                                                         \
@@ -155,6 +566,21 @@ inline Local<Object> tcmaptoobj (TCMAP *map) {
     return 0;                                                                 \
   }
 
+/* async method which can be coalesced with others called in the same tick
+ * (see TCWrap::Enqueue) */
+#define DEFINE_ASYNC_QUEUED_FUNC(name)                                        \
+  static Handle<Value>                                                        \
+  name##Async (const Arguments& args) {                                       \
+    HandleScope scope;                                                        \
+    if (!name##Data::checkArgs(args)) {                                       \
+      return THROW_BAD_ARGS;                                                  \
+    }                                                                         \
+    name##AsyncData *data = new name##AsyncData(args);                        \
+    Enqueue(THIS, Exec##name, After##name, data);                             \
+    ev_ref(EV_DEFAULT_UC);                                                    \
+    return Undefined();                                                       \
+  }                                                                           \
+
 #define DEFINE_ASYNC(name)                                                    \
   DEFINE_ASYNC_FUNC(name)                                                     \
   DEFINE_ASYNC_EXEC(name)                                                     \
@@ -165,6 +591,21 @@ inline Local<Object> tcmaptoobj (TCMAP *map) {
   DEFINE_ASYNC_EXEC(name)                                                     \
   DEFINE_ASYNC_AFTER2(name)                                                   \
 
+#define DEFINE_ASYNC2_READ(name)                                              \
+  DEFINE_ASYNC_READ_FUNC(name)                                                \
+  DEFINE_ASYNC_EXEC(name)                                                     \
+  DEFINE_ASYNC_AFTER2(name)                                                   \
+
+#define DEFINE_ASYNC_QUEUED(name)                                             \
+  DEFINE_ASYNC_EXEC(name)                                                     \
+  DEFINE_ASYNC_AFTER(name)                                                    \
+  DEFINE_ASYNC_QUEUED_FUNC(name)                                              \
+
+#define DEFINE_ASYNC2_QUEUED(name)                                            \
+  DEFINE_ASYNC_EXEC(name)                                                     \
+  DEFINE_ASYNC_AFTER2(name)                                                   \
+  DEFINE_ASYNC_QUEUED_FUNC(name)                                              \
+
 // Tokyo Cabinet error codes
 inline void set_ecodes (const Handle<FunctionTemplate> tmpl) {
   DEFINE_PREFIXED_CONSTANT(tmpl, TC, ESUCCESS);
@@ -193,9 +634,305 @@ inline void set_ecodes (const Handle<FunctionTemplate> tmpl) {
   DEFINE_PREFIXED_CONSTANT(tmpl, TC, EMISC);
 }
 
+// Async job executed outside of its own eio request (in a batch or by an
+// Executor). exec and after are the same functions given to eio_custom.
+class AsyncJob {
+  private:
+    eio_cb exec;
+    eio_cb after;
+    eio_req req;
+
+  public:
+    AsyncJob (eio_cb exec_, eio_cb after_, void *data)
+        : exec(exec_), after(after_) {
+      memset(&req, 0, sizeof(req));
+      req.data = data;
+    }
+
+    void
+    run () {
+      exec(&req);
+    }
+
+    void
+    done () {
+      after(&req);
+    }
+};
+
+// Dedicated thread which executes async jobs of a database one at a time.
+// Since only this thread touches the database, it needs no mutex.
+// Callbacks are called in the main thread through an ev_async watcher.
+class Executor {
+  private:
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    TCPTRLIST *jobs; // waiting to be run
+    TCPTRLIST *done; // waiting for callbacks
+    ev_async notifier;
+    bool stopping;
+    int refs;
+
+    static void *
+    Run (void *arg) {
+      Executor *ex = static_cast<Executor *>(arg);
+      AsyncJob *job;
+      pthread_mutex_lock(&ex->mutex);
+      for (;;) {
+        while (tcptrlistnum(ex->jobs) == 0 && !ex->stopping) {
+          pthread_cond_wait(&ex->cond, &ex->mutex);
+        }
+        if (tcptrlistnum(ex->jobs) == 0) break;
+        job = static_cast<AsyncJob *>(tcptrlistshift(ex->jobs));
+        pthread_mutex_unlock(&ex->mutex);
+        job->run();
+        pthread_mutex_lock(&ex->mutex);
+        tcptrlistpush(ex->done, job);
+        ev_async_send(EV_DEFAULT_UC, &ex->notifier);
+      }
+      pthread_mutex_unlock(&ex->mutex);
+      return NULL;
+    }
+
+    static void
+    Notify (EV_P_ ev_async *watcher, int revents) {
+      Executor *ex = static_cast<Executor *>(watcher->data);
+      pthread_mutex_lock(&ex->mutex);
+      TCPTRLIST *finished = ex->done;
+      ex->done = tcptrlistnew();
+      pthread_mutex_unlock(&ex->mutex);
+      int num = tcptrlistnum(finished);
+      for (int i = 0; i < num; i++) {
+        AsyncJob *job = static_cast<AsyncJob *>(tcptrlistval(finished, i));
+        job->done();
+        delete job;
+      }
+      tcptrlistdel(finished);
+    }
+
+    ~Executor () {
+      pthread_mutex_lock(&mutex);
+      stopping = true;
+      pthread_cond_signal(&cond);
+      pthread_mutex_unlock(&mutex);
+      pthread_join(thread, NULL);
+      ev_ref(EV_DEFAULT_UC);
+      ev_async_stop(EV_DEFAULT_UC, &notifier);
+      pthread_cond_destroy(&cond);
+      pthread_mutex_destroy(&mutex);
+      tcptrlistdel(jobs);
+      tcptrlistdel(done);
+    }
+
+  public:
+    Executor () : stopping(false), refs(1) {
+      jobs = tcptrlistnew();
+      done = tcptrlistnew();
+      pthread_mutex_init(&mutex, NULL);
+      pthread_cond_init(&cond, NULL);
+      ev_async_init(&notifier, Notify);
+      notifier.data = this;
+      ev_async_start(EV_DEFAULT_UC, &notifier);
+      // pending jobs keep the loop alive, not the watcher itself
+      ev_unref(EV_DEFAULT_UC);
+      pthread_create(&thread, NULL, Run, this);
+    }
+
+    void
+    Retain () {
+      refs++;
+    }
+
+    void
+    Release () {
+      if (--refs == 0) delete this;
+    }
+
+    void
+    Push (AsyncJob *job) {
+      pthread_mutex_lock(&mutex);
+      tcptrlistpush(jobs, job);
+      pthread_cond_signal(&cond);
+      pthread_mutex_unlock(&mutex);
+    }
+};
+
+// monotonic clock in nanoseconds, for latency statistics
+inline uint64_t nowns () {
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+#endif
+}
+
+// Histogram of durations in the manner of HdrHistogram: 16 buckets for
+// each power of two, so percentiles are within 1/16 of the real value,
+// and the size is fixed (2.3KB) whatever the number of values.
+class Histogram {
+  private:
+    static const int SUBBITS = 4;
+    static const int SUB = 1 << SUBBITS;
+    // values from 2^40 ns (18 minutes) are counted in the last bucket
+    static const int MAXBITS = 40;
+    static const int BUCKETS = (MAXBITS - SUBBITS + 1) * SUB;
+
+    uint32_t counts[BUCKETS];
+    uint64_t num;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+
+    static int
+    index (uint64_t val) {
+      if (val >= (1ULL << MAXBITS)) val = (1ULL << MAXBITS) - 1;
+      if (val < static_cast<uint64_t>(SUB)) return val;
+      int shift = 63 - __builtin_clzll(val) - SUBBITS;
+      return (shift + 1) * SUB + ((val >> shift) & (SUB - 1));
+    }
+
+    // largest value counted in bucket idx
+    static uint64_t
+    upper (int idx) {
+      int row = idx / SUB;
+      if (row == 0) return idx;
+      int shift = row - 1;
+      return (static_cast<uint64_t>(SUB + idx % SUB) << shift) +
+             (1ULL << shift) - 1;
+    }
+
+    static Local<Number>
+    usec (uint64_t ns) {
+      return Number::New(ns / 1000.0);
+    }
+
+  public:
+    Histogram () {
+      reset();
+    }
+
+    void
+    reset () {
+      memset(counts, 0, sizeof(counts));
+      num = sum = max = 0;
+      min = UINT64_MAX;
+    }
+
+    void
+    add (uint64_t val) {
+      counts[index(val)]++;
+      num++;
+      sum += val;
+      if (val < min) min = val;
+      if (val > max) max = val;
+    }
+
+    uint64_t
+    percentile (double p) {
+      uint64_t rank = static_cast<uint64_t>(p * num + 0.5);
+      if (rank < 1) rank = 1;
+      uint64_t seen = 0;
+      for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) return upper(i) < max ? upper(i) : max;
+      }
+      return max;
+    }
+
+    // {min, mean, p50, p90, p99, p999, max} in microseconds
+    Local<Object>
+    toObject () {
+      HandleScope scope;
+      Local<Object> obj = Object::New();
+      obj->Set(String::NewSymbol("min"), usec(num > 0 ? min : 0));
+      obj->Set(String::NewSymbol("mean"), usec(num > 0 ? sum / num : 0));
+      obj->Set(String::NewSymbol("p50"), usec(percentile(0.5)));
+      obj->Set(String::NewSymbol("p90"), usec(percentile(0.9)));
+      obj->Set(String::NewSymbol("p99"), usec(percentile(0.99)));
+      obj->Set(String::NewSymbol("p999"), usec(percentile(0.999)));
+      obj->Set(String::NewSymbol("max"), usec(max));
+      return scope.Close(obj);
+    }
+};
+
+// Latencies of one async method, split at the start and the end of its
+// execution in a thread: the wait in the queue (of eio, an executor or
+// a coalesced batch), the execution, and the wait for the main thread to
+// call the callback.
+class Latency {
+  public:
+    uint64_t count;
+    Histogram queue;
+    Histogram exec;
+    Histogram deliver;
+    Histogram total;
+
+    Latency () : count(0) {}
+
+    void
+    add (uint64_t submitted, uint64_t started, uint64_t finished,
+         uint64_t delivered) {
+      count++;
+      queue.add(started - submitted);
+      exec.add(finished - started);
+      deliver.add(delivered - finished);
+      total.add(delivered - submitted);
+    }
+
+    Local<Object>
+    toObject () {
+      HandleScope scope;
+      Local<Object> obj = Object::New();
+      obj->Set(String::NewSymbol("count"),
+               Number::New(static_cast<double>(count)));
+      obj->Set(String::NewSymbol("queue"), queue.toObject());
+      obj->Set(String::NewSymbol("exec"), exec.toObject());
+      obj->Set(String::NewSymbol("deliver"), deliver.toObject());
+      obj->Set(String::NewSymbol("total"), total.toObject());
+      return scope.Close(obj);
+    }
+};
+
 // Database wrapper (interfaces for database objects, all included)
 class TCWrap : public ObjectWrap {
   public:
+    // whether values are returned as Buffers instead of Strings
+    bool binary;
+    // whether lists are returned packed in a Buffer (see tclisttopacked)
+    bool packed;
+    // size from which values are returned without copying (0 for never)
+    int external;
+
+    TCWrap () : binary(false), packed(false), external(0), coalesce(false), queue(NULL), executor(NULL),
+                writer(NULL), latency(NULL) {
+      ev_prepare_init(&flusher, Flush);
+      flusher.data = this;
+    }
+
+    ~TCWrap () {
+      if (queue != NULL) tcptrlistdel(queue);
+      if (executor != NULL) executor->Release();
+      if (writer != NULL) writer->Release();
+      ClearLatency();
+    }
+
+    // cursors and queries follow the settings of their database
+    void
+    Inherit (TCWrap *db) {
+      binary = db->binary;
+      packed = db->packed;
+      external = db->external;
+      executor = db->executor;
+      if (executor != NULL) executor->Retain();
+      writer = db->writer;
+      if (writer != NULL) writer->Retain();
+    }
+
     // these methods must be overridden in individual DB classes
     virtual int Ecode () { assert(false); }
     virtual const char * Errmsg (int ecode) { assert(false); }
@@ -260,12 +997,145 @@ class TCWrap : public ObjectWrap {
     virtual bool Out () { assert(false); } // for CUR
     virtual char * Key (int *vsiz_p) { assert(false); } // for CUR
     virtual char * Val (int *vsiz_p) { assert(false); } // for CUR
+    virtual bool Rec (TCXSTR *kxstr, TCXSTR *vxstr) { assert(false); } // for CUR
     // for TDB Query
     virtual TCLIST * Search () { assert(false); } // for QRY
     virtual bool Searchout () { assert(false); } // for QRY
     virtual TCLIST * Metasearch (TDBQRY **qrys, int num, int type) { assert(false); } // for QRY
 
   protected:
+    // serial executor thread (see setserial)
+    Executor *executor;
+    // writer lane of a database with mutex (see setmutex)
+    Executor *writer;
+
+    /* All async jobs are handed to eio or to an executor from here.
+     * With setserial, every job goes to the executor of the database.
+     * With setmutex, jobs which only read go to the eio pool to run in
+     * parallel and the others go one by one to the writer lane, so reads
+     * don't wait for long writes in the eio queue. */
+    void
+    Dispatch (eio_cb exec, eio_cb after, void *data, bool reader) {
+      if (executor != NULL) {
+        executor->Push(new AsyncJob(exec, after, data));
+      } else if (writer != NULL && !reader) {
+        writer->Push(new AsyncJob(exec, after, data));
+      } else {
+        eio_custom(exec, EIO_PRI_DEFAULT, after, data);
+      }
+    }
+
+    /* Writes still queued for coalescing are dispatched first, so a job
+     * which is not coalesced never overtakes the writes called before it
+     * (see Enqueue). */
+    static void
+    Submit (const Handle<Object> obj, eio_cb exec, eio_cb after, void *data,
+                                                                bool reader) {
+      TCWrap *tcw = Unwrap<TCWrap>(obj);
+      if (tcw->queue != NULL) tcw->FlushQueue();
+      tcw->Dispatch(exec, after, data, reader);
+    }
+
+    // write coalescing (see setcoalesce)
+    bool coalesce;
+    int maxbatch;
+    TCPTRLIST *queue;
+    ev_prepare flusher;
+
+    /* Async methods defined with DEFINE_ASYNC_QUEUED come here.
+     * When coalescing is enabled, jobs are kept in the queue until the
+     * current tick ends (or until maxbatch jobs are queued) and then
+     * executed in order in one eio request. */
+    static void
+    Enqueue (const Handle<Object> obj, eio_cb exec, eio_cb after, void *data) {
+      TCWrap *tcw = Unwrap<TCWrap>(obj);
+      if (!tcw->coalesce) {
+        tcw->Dispatch(exec, after, data, false);
+        return;
+      }
+      tcptrlistpush(tcw->queue, new AsyncJob(exec, after, data));
+      if (tcptrlistnum(tcw->queue) >= tcw->maxbatch) {
+        tcw->FlushQueue();
+      } else if (!ev_is_active(&tcw->flusher)) {
+        // prepare watchers run once the loop is done with the current tick
+        ev_prepare_start(EV_DEFAULT_UC, &tcw->flusher);
+      }
+    }
+
+    void
+    FlushQueue () {
+      if (ev_is_active(&flusher)) {
+        ev_prepare_stop(EV_DEFAULT_UC, &flusher);
+      }
+      if (tcptrlistnum(queue) == 0) return;
+      Dispatch(ExecBatch, AfterBatch, queue, false);
+      queue = tcptrlistnew();
+    }
+
+    // latency statistics of async methods by name (see latencyStats)
+    TCMAP *latency;
+
+    void
+    RecordLatency (const char *name, uint64_t submitted, uint64_t started,
+                   uint64_t finished) {
+      uint64_t delivered = nowns();
+      if (latency == NULL) latency = tcmapnew();
+      int len = strlen(name);
+      int siz;
+      Latency *lat;
+      const void *vbuf = tcmapget(latency, name, len, &siz);
+      if (vbuf != NULL) {
+        memcpy(&lat, vbuf, sizeof(lat));
+      } else {
+        lat = new Latency;
+        tcmapput(latency, name, len, &lat, sizeof(lat));
+      }
+      lat->add(submitted, started, finished, delivered);
+    }
+
+    void
+    ClearLatency () {
+      if (latency == NULL) return;
+      const void *kbuf;
+      int ksiz, vsiz;
+      Latency *lat;
+      tcmapiterinit(latency);
+      while ((kbuf = tcmapiternext(latency, &ksiz)) != NULL) {
+        memcpy(&lat, tcmapiterval(kbuf, &vsiz), sizeof(lat));
+        delete lat;
+      }
+      tcmapdel(latency);
+      latency = NULL;
+    }
+
+    static void
+    Flush (EV_P_ ev_prepare *watcher, int revents) {
+      static_cast<TCWrap *>(watcher->data)->FlushQueue();
+    }
+
+    static int
+    ExecBatch (eio_req *req) {
+      TCPTRLIST *jobs = static_cast<TCPTRLIST *>(req->data);
+      int num = tcptrlistnum(jobs);
+      for (int i = 0; i < num; i++) {
+        static_cast<AsyncJob *>(tcptrlistval(jobs, i))->run();
+      }
+      return 0;
+    }
+
+    static int
+    AfterBatch (eio_req *req) {
+      TCPTRLIST *jobs = static_cast<TCPTRLIST *>(req->data);
+      int num = tcptrlistnum(jobs);
+      for (int i = 0; i < num; i++) {
+        AsyncJob *job = static_cast<AsyncJob *>(tcptrlistval(jobs, i));
+        job->done();
+        delete job;
+      }
+      tcptrlistdel(jobs);
+      return 0;
+    }
+
     class ArgsData {
       protected:
         TCWrap *tcw;
@@ -291,15 +1161,28 @@ class TCWrap : public ObjectWrap {
         ecode () {
           return tcw->Ecode();
         }
+
+        // commits the transaction if ok, or aborts it otherwise
+        bool
+        endtran (bool ok) {
+          if (ok) return tcw->Trancommit();
+          tcw->Tranabort();
+          return false;
+        }
     };
 
     class AsyncData : public virtual ArgsData {
       public:
         Persistent<Function> cb;
         bool hasCallback;
+        // when the method was called and when it ran (see latencyStats)
+        uint64_t submitted;
+        uint64_t started;
+        uint64_t finished;
 
-        AsyncData (Handle<Value> cb_) {
+        AsyncData (Handle<Value> cb_) : started(0), finished(0) {
           HandleScope scope;
+          submitted = nowns();
           assert(tcw); // make sure ArgsData is already initialized with This value
           tcw->Ref();
           if (cb_->IsFunction()) {
@@ -325,6 +1208,13 @@ class TCWrap : public ObjectWrap {
           }
         }
 
+        // adds the latencies of this call to the statistics of the object
+        inline void
+        record (const char *name) {
+          if (started != 0) tcw->RecordLatency(name, submitted, started,
+                                               finished);
+        }
+
         inline void
         callCallback (Handle<Value> arg0) {
           HandleScope scope;
@@ -391,7 +1281,9 @@ class TCWrap : public ObjectWrap {
         SetmutexData (const Arguments& args) : ArgsData(args) {}
 
         bool run () {
-          return tcw->Setmutex();
+          if (!tcw->Setmutex()) return false;
+          if (tcw->writer == NULL) tcw->writer = new Executor;
+          return true;
         }
     };
 
@@ -435,6 +1327,183 @@ class TCWrap : public ObjectWrap {
         }
     };
 
+    class SetbinaryData : public ArgsData {
+      private:
+        bool binary;
+
+      public:
+        SetbinaryData (const Arguments& args) : ArgsData(args) {
+          binary = NOU(args[0]) || args[0]->BooleanValue();
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return args[0]->IsBoolean() || NOU(args[0]);
+        }
+
+        bool
+        run () {
+          tcw->binary = binary;
+          return true;
+        }
+    };
+
+    DEFINE_SYNC(Setbinary)
+
+    // Return lists of keys and values as [Buffer, offsets] instead of
+    // Arrays of strings
+    class SetpackedData : public ArgsData {
+      private:
+        bool packed;
+
+      public:
+        SetpackedData (const Arguments& args) : ArgsData(args) {
+          packed = NOU(args[0]) || args[0]->BooleanValue();
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return args[0]->IsBoolean() || NOU(args[0]);
+        }
+
+        bool
+        run () {
+          tcw->packed = packed;
+          return true;
+        }
+    };
+
+    DEFINE_SYNC(Setpacked)
+
+    // Return values of the given size or larger without copying them
+    // arg[0] : threshold in bytes (0 to always copy)
+    class SetexternalData : public ArgsData {
+      private:
+        int threshold;
+
+      public:
+        SetexternalData (const Arguments& args) : ArgsData(args) {
+          threshold = args[0]->Int32Value();
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return args[0]->IsNumber();
+        }
+
+        bool
+        run () {
+          if (threshold < 0) return false;
+          tcw->external = threshold;
+          return true;
+        }
+    };
+
+    DEFINE_SYNC(Setexternal)
+
+    // Coalesce putAsync, outAsync and addintAsync called in the same tick
+    // arg[0] : true to enable (default), false to disable
+    // arg[1] : maximum number of jobs in a batch (default 1024)
+    class SetcoalesceData : public ArgsData {
+      private:
+        bool coalesce;
+        int maxbatch;
+
+      public:
+        SetcoalesceData (const Arguments& args) : ArgsData(args) {
+          coalesce = NOU(args[0]) || args[0]->BooleanValue();
+          maxbatch = NOU(args[1]) ? 1024 : args[1]->Int32Value();
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return (NOU(args[0]) || args[0]->IsBoolean()) &&
+                 (NOU(args[1]) || args[1]->IsNumber());
+        }
+
+        bool
+        run () {
+          if (maxbatch < 1) return false;
+          if (tcw->queue == NULL) {
+            tcw->queue = tcptrlistnew();
+          } else if (!coalesce) {
+            tcw->FlushQueue();
+          }
+          tcw->coalesce = coalesce;
+          tcw->maxbatch = maxbatch;
+          return true;
+        }
+    };
+
+    DEFINE_SYNC(Setcoalesce)
+
+    // Run async methods one by one in a thread dedicated to this database.
+    // Must be called before any async method is called. Cursors and queries
+    // created afterwards share the thread.
+    class SetserialData : public ArgsData {
+      public:
+        SetserialData (const Arguments& args) : ArgsData(args) {}
+
+        bool
+        run () {
+          if (tcw->executor == NULL) tcw->executor = new Executor;
+          return true;
+        }
+    };
+
+    DEFINE_SYNC(Setserial)
+
+    // Latencies of the async methods called on this object, by method name:
+    // {get: {count, queue, exec, deliver, total}, ...}, where each phase
+    // is {min, mean, p50, p90, p99, p999, max} in microseconds
+    // arg[0] : whether to reset the statistics after reading them
+    class LatencyStatsData : public ArgsData {
+      private:
+        bool reset;
+
+      public:
+        static bool
+        checkArgs (const Arguments& args) {
+          return NOU(args[0]) || args[0]->IsBoolean();
+        }
+
+        LatencyStatsData (const Arguments& args) : ArgsData(args) {
+          reset = args[0]->BooleanValue();
+        }
+
+        bool
+        run () {
+          return true;
+        }
+
+        Local<Value>
+        returnValue () {
+          HandleScope scope;
+          Local<Object> obj = Object::New();
+          if (tcw->latency == NULL) return scope.Close(obj);
+          const char *kbuf;
+          int ksiz, vsiz;
+          Latency *lat;
+          char name[64];
+          tcmapiterinit(tcw->latency);
+          while ((kbuf = static_cast<const char *>(
+                    tcmapiternext(tcw->latency, &ksiz))) != NULL) {
+            memcpy(&lat, tcmapiterval(kbuf, &vsiz), sizeof(lat));
+            // recorded by class name (Get), reported by method name (get)
+            if (ksiz >= static_cast<int>(sizeof(name))) {
+              ksiz = sizeof(name) - 1;
+            }
+            memcpy(name, kbuf, ksiz);
+            name[0] = tolower(name[0]);
+            obj->Set(String::New(name, ksiz), lat->toObject());
+          }
+          if (reset) tcw->ClearLatency();
+          return scope.Close(obj);
+        }
+    };
+
+    DEFINE_SYNC2(LatencyStats)
+
     class FilenameData : public virtual ArgsData {
       protected:
         String::Utf8Value path;
@@ -465,7 +1534,7 @@ class TCWrap : public ObjectWrap {
 
     class KeyData : public virtual ArgsData {
       protected:
-        String::Utf8Value kbuf;
+        ByteValue kbuf;
         int ksiz;
 
       public:
@@ -476,7 +1545,7 @@ class TCWrap : public ObjectWrap {
 
     class PutData : public KeyData {
       protected:
-        String::Utf8Value vbuf;
+        ByteValue vbuf;
         int vsiz;
 
       public:
@@ -568,7 +1637,12 @@ class TCWrap : public ObjectWrap {
       public:
         PutlistData (const Arguments& args) : KeyData(args), ArgsData(args) {
           HandleScope scope;
-          list = arytotclist(Handle<Array>::Cast(args[0]));
+          list = arytotclist(Handle<Array>::Cast(args[1]));
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return args[1]->IsArray();
         }
 
         ~PutlistData () {
@@ -600,10 +1674,73 @@ class TCWrap : public ObjectWrap {
         Handle<Value>
         returnValue () {
           HandleScope scope;
-          return vbuf == NULL ? Null() : scope.Close(String::New(vbuf, vsiz));
+          return vbuf == NULL ? Null() :
+            scope.Close(takeval(&vbuf, vsiz, tcw->binary, tcw->external));
+        }
+    };
+
+    // Store many records at once
+    // arg[0] : Array of [key, value]
+    // arg[1] : options ({tx: true} wraps the whole batch in a transaction)
+    class PutmanyData : public virtual ArgsData {
+      protected:
+        TCLIST *keys;
+        TCLIST *vals;
+        int num;
+        bool tx;
+
+      public:
+        PutmanyData (const Arguments& args) : ArgsData(args) {
+          HandleScope scope;
+          Local<Array> ary = Local<Array>::Cast(args[0]);
+          Local<Array> pair;
+          num = ary->Length();
+          keys = tclistnew2(num);
+          vals = tclistnew2(num);
+          for (int i = 0; i < num; i++) {
+            pair = Local<Array>::Cast(ary->Get(i));
+            ByteValue kbuf(pair->Get(0));
+            ByteValue vbuf(pair->Get(1));
+            tclistpush(keys, *kbuf, kbuf.length());
+            tclistpush(vals, *vbuf, vbuf.length());
+          }
+          tx = optbool(args[1], "tx");
+        }
+
+        ~PutmanyData () {
+          tclistdel(keys);
+          tclistdel(vals);
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return ispairary(args[0]) && (NOU(args[1]) || args[1]->IsObject());
+        }
+
+        bool
+        run () {
+          if (tx && !tcw->Tranbegin()) return false;
+          bool ok = true;
+          int ksiz, vsiz;
+          for (int i = 0; ok && i < num; i++) {
+            const void *kbuf = tclistval(keys, i, &ksiz);
+            const void *vbuf = tclistval(vals, i, &vsiz);
+            ok = tcw->Put(static_cast<char *>(const_cast<void *>(kbuf)), ksiz,
+                          static_cast<char *>(const_cast<void *>(vbuf)), vsiz);
+          }
+          return tx ? endtran(ok) : ok;
         }
     };
 
+    class PutmanyAsyncData : public PutmanyData, public AsyncData {
+      public:
+        // options may be left out before the callback
+        PutmanyAsyncData (const Arguments& args)
+          : PutmanyData(args),
+            AsyncData(args[1]->IsFunction() ? args[1] : args[2]),
+            ArgsData(args) {}
+    };
+
     class OutData : public KeyData {
       public:
         OutData (const Arguments& args) : KeyData(args), ArgsData(args) {}
@@ -653,6 +1790,116 @@ class TCWrap : public ObjectWrap {
           : GetData(args), AsyncData(args[1]), ArgsData(args) {}
     };
 
+    // keys given as an Array (element i of the Array is element i of the list)
+    class KeylistData : public virtual ArgsData {
+      protected:
+        TCLIST *keys;
+        int knum;
+
+      public:
+        KeylistData (const Arguments& args) : ArgsData(args) {
+          HandleScope scope;
+          Local<Array> ary = Local<Array>::Cast(args[0]);
+          knum = ary->Length();
+          keys = tclistnew2(knum);
+          for (int i = 0; i < knum; i++) {
+            ByteValue kbuf(ary->Get(i));
+            tclistpush(keys, *kbuf, kbuf.length());
+          }
+        }
+
+        ~KeylistData () {
+          tclistdel(keys);
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return args[0]->IsArray();
+        }
+
+        char *
+        key (int i, int *ksiz_p) {
+          return static_cast<char *>(const_cast<void *>(
+                tclistval(keys, i, ksiz_p)));
+        }
+    };
+
+    // Get values of many keys at once
+    // arg[0] : Array of keys
+    // returns an Array of values (null for missing records)
+    class GetmanyData : public KeylistData {
+      protected:
+        char **vbufs;
+        int *vsizs;
+
+      public:
+        GetmanyData (const Arguments& args) : KeylistData(args), ArgsData(args) {
+          vbufs = static_cast<char **>(tccalloc(knum + 1, sizeof(*vbufs)));
+          vsizs = static_cast<int *>(tccalloc(knum + 1, sizeof(*vsizs)));
+        }
+
+        ~GetmanyData () {
+          for (int i = 0; i < knum; i++) {
+            tcfree(vbufs[i]);
+          }
+          tcfree(vbufs);
+          tcfree(vsizs);
+        }
+
+        bool
+        run () {
+          char *kbuf;
+          int ksiz;
+          for (int i = 0; i < knum; i++) {
+            kbuf = key(i, &ksiz);
+            vbufs[i] = tcw->Get(kbuf, ksiz, &vsizs[i]);
+          }
+          return true;
+        }
+
+        Handle<Value>
+        returnValue () {
+          HandleScope scope;
+          Local<Array> ary = Array::New(knum);
+          for (int i = 0; i < knum; i++) {
+            ary->Set(i, vbufs[i] == NULL ? Handle<Value>(Null()) :
+                Handle<Value>(takeval(vbufs + i, vsizs[i], tcw->binary,
+                                      tcw->external)));
+          }
+          return scope.Close(ary);
+        }
+    };
+
+    class GetmanyAsyncData : public GetmanyData, public AsyncData {
+      public:
+        GetmanyAsyncData (const Arguments& args)
+          : GetmanyData(args), AsyncData(args[1]), ArgsData(args) {}
+    };
+
+    // Remove many records at once (stops at the first failure)
+    // arg[0] : Array of keys
+    class OutmanyData : public KeylistData {
+      public:
+        OutmanyData (const Arguments& args) : KeylistData(args), ArgsData(args) {}
+
+        bool
+        run () {
+          char *kbuf;
+          int ksiz;
+          for (int i = 0; i < knum; i++) {
+            kbuf = key(i, &ksiz);
+            if (!tcw->Out(kbuf, ksiz)) return false;
+          }
+          return true;
+        }
+    };
+
+    class OutmanyAsyncData : public OutmanyData, public AsyncData {
+      public:
+        OutmanyAsyncData (const Arguments& args)
+          : OutmanyData(args), AsyncData(args[1]), ArgsData(args) {}
+    };
+
     class GetlistData : public KeyData {
       protected:
         TCLIST *list;
@@ -673,7 +1920,7 @@ class TCWrap : public ObjectWrap {
         Handle<Value>
         returnValue () {
           HandleScope scope;
-          return scope.Close(tclisttoary(list));
+          return scope.Close(tclisttoval(list, tcw->binary, tcw->packed));
         }
     };
 
@@ -826,6 +2073,80 @@ class TCWrap : public ObjectWrap {
           : IternextData(args), AsyncData(args[0]), ArgsData(args) {}
     };
 
+    // Advance the iterator up to n times in one call
+    // arg[0] : maximum number of records
+    // arg[1] : options ({values: true} to get values as well)
+    // returns [keys, values] (values is null unless requested)
+    class IternextmanyData : public virtual ArgsData {
+      protected:
+        int max;
+        bool values;
+        TCLIST *keys;
+        TCLIST *vals;
+
+      public:
+        IternextmanyData (const Arguments& args) : ArgsData(args) {
+          max = args[0]->Int32Value();
+          values = optbool(args[1], "values");
+          keys = tclistnew2(max > 0 ? max : 1);
+          vals = values ? tclistnew2(max > 0 ? max : 1) : NULL;
+        }
+
+        ~IternextmanyData () {
+          tclistdel(keys);
+          if (vals != NULL) tclistdel(vals);
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return args[0]->IsNumber() && args[0]->Int32Value() > 0 &&
+            (NOU(args[1]) || args[1]->IsObject());
+        }
+
+        bool
+        run () {
+          char *kbuf, *vbuf;
+          int ksiz, vsiz;
+          while (tclistnum(keys) < max) {
+            kbuf = tcw->Iternext(&ksiz);
+            if (kbuf == NULL) break;
+            if (values) {
+              // skip records removed since the key was visited
+              vbuf = tcw->Get(kbuf, ksiz, &vsiz);
+              if (vbuf != NULL) {
+                tclistpush(keys, kbuf, ksiz);
+                tclistpush(vals, vbuf, vsiz);
+                tcfree(vbuf);
+              }
+            } else {
+              tclistpush(keys, kbuf, ksiz);
+            }
+            tcfree(kbuf);
+          }
+          return tclistnum(keys) > 0;
+        }
+
+        Handle<Value>
+        returnValue () {
+          HandleScope scope;
+          Local<Array> ary = Array::New(2);
+          ary->Set(0, tclisttoval(keys, tcw->binary, tcw->packed));
+          ary->Set(1, values ?
+              Handle<Value>(tclisttoval(vals, tcw->binary, tcw->packed)) :
+              Handle<Value>(Null()));
+          return scope.Close(ary);
+        }
+    };
+
+    class IternextmanyAsyncData : public IternextmanyData, public AsyncData {
+      public:
+        // options may be left out before the callback
+        IternextmanyAsyncData (const Arguments& args)
+          : IternextmanyData(args),
+            AsyncData(args[1]->IsFunction() ? args[1] : args[2]),
+            ArgsData(args) {}
+    };
+
     class AdddoubleData : public KeyData {
       protected:
         double num;
@@ -1049,6 +2370,12 @@ class HDB : public TCWrap {
       NODE_SET_PROTOTYPE_METHOD(tmpl, "errmsg", ErrmsgSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "ecode", EcodeSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "setmutex", SetmutexSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setserial", SetserialSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setbinary", SetbinarySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setpacked", SetpackedSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setexternal", SetexternalSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setcoalesce", SetcoalesceSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "latencyStats", LatencyStatsSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "tune", TuneSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "setcache", SetcacheSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "setxmsiz", SetxmsizSync);
@@ -1067,14 +2394,22 @@ class HDB : public TCWrap {
       NODE_SET_PROTOTYPE_METHOD(tmpl, "putasyncAsync", PutasyncAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "out", OutSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "outAsync", OutAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "putmany", PutmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "putmanyAsync", PutmanyAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "outmany", OutmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "outmanyAsync", OutmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "get", GetSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "getAsync", GetAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "getmany", GetmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "getmanyAsync", GetmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "vsiz", VsizSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "vsizAsync", VsizAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iterinit", IterinitSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iterinitAsync", IterinitAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iternext", IternextSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iternextAsync", IternextAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "iternextmany", IternextmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "iternextmanyAsync", IternextmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "fwmkeys", FwmkeysSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "fwmkeysAsync", FwmkeysAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "addint", AddintSync);
@@ -1249,7 +2584,7 @@ class HDB : public TCWrap {
     }
 
     DEFINE_SYNC(Put)
-    DEFINE_ASYNC(Put)
+    DEFINE_ASYNC_QUEUED(Put)
 
     bool Putkeep(char *kbuf, int ksiz, char *vbuf, int vsiz) {
       return tchdbputkeep(hdb, kbuf, ksiz, vbuf, vsiz);
@@ -1277,21 +2612,27 @@ class HDB : public TCWrap {
     }
 
     DEFINE_SYNC(Out)
-    DEFINE_ASYNC(Out)
+    DEFINE_ASYNC_QUEUED(Out)
+    DEFINE_SYNC(Putmany)
+    DEFINE_ASYNC(Putmany)
+    DEFINE_SYNC(Outmany)
+    DEFINE_ASYNC(Outmany)
 
     char * Get(char *kbuf, int ksiz, int *vsiz_p) {
       return static_cast<char *>(tchdbget(hdb, kbuf, ksiz, vsiz_p));
     }
 
     DEFINE_SYNC2(Get)
-    DEFINE_ASYNC2(Get)
+    DEFINE_ASYNC2_READ(Get)
+    DEFINE_SYNC2(Getmany)
+    DEFINE_ASYNC2_READ(Getmany)
 
     int Vsiz(char *kbuf, int ksiz) {
       return tchdbvsiz(hdb, kbuf, ksiz);
     }
 
     DEFINE_SYNC2(Vsiz)
-    DEFINE_ASYNC2(Vsiz)
+    DEFINE_ASYNC2_READ(Vsiz)
 
     bool Iterinit () {
       return tchdbiterinit(hdb);
@@ -1306,20 +2647,22 @@ class HDB : public TCWrap {
 
     DEFINE_SYNC2(Iternext)
     DEFINE_ASYNC2(Iternext)
+    DEFINE_SYNC2(Iternextmany)
+    DEFINE_ASYNC2(Iternextmany)
 
     TCLIST * Fwmkeys(char *kbuf, int ksiz, int max) {
       return tchdbfwmkeys(hdb, kbuf, ksiz, max);
     }
 
     DEFINE_SYNC2(Fwmkeys)
-    DEFINE_ASYNC2(Fwmkeys)
+    DEFINE_ASYNC2_READ(Fwmkeys)
 
     int Addint(char *kbuf, int ksiz, int num) {
       return tchdbaddint(hdb, kbuf, ksiz, num);
     }
 
     DEFINE_SYNC2(Addint)
-    DEFINE_ASYNC2(Addint)
+    DEFINE_ASYNC2_QUEUED(Addint)
 
     double Adddouble(char *kbuf, int ksiz, double num) {
       return tchdbadddouble(hdb, kbuf, ksiz, num);
@@ -1447,6 +2790,12 @@ class BDB : public TCWrap {
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "errmsg", ErrmsgSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "ecode", EcodeSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "setmutex", SetmutexSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setserial", SetserialSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setbinary", SetbinarySync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setpacked", SetpackedSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setexternal", SetexternalSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setcoalesce", SetcoalesceSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "latencyStats", LatencyStatsSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "tune", TuneSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "setcache", SetcacheSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "setxmsiz", SetxmsizSync);
@@ -1467,10 +2816,16 @@ class BDB : public TCWrap {
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "putlistAsync", PutlistAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "out", OutSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "outAsync", OutAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "putmany", PutmanySync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "putmanyAsync", PutmanyAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "outmany", OutmanySync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "outmanyAsync", OutmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "outlist", OutlistSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "outlistAsync", OutlistAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "get", GetSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "getAsync", GetAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "getmany", GetmanySync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "getmanyAsync", GetmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "getlist", GetlistSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "getlistAsync", GetlistAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "vnum", VnumSync);
@@ -1502,12 +2857,16 @@ class BDB : public TCWrap {
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "path", PathSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "rnum", RnumSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "fsiz", FsizSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "createReadStream", CreateReadStream);
 
       target->Set(String::New("BDB"), Tmpl->GetFunction());
     }
 
   private:
 
+    // defined after STM
+    static Handle<Value> CreateReadStream (const Arguments& args);
+
     static Handle<Value>
     New (const Arguments& args) {
       HandleScope scope;
@@ -1662,7 +3021,7 @@ class BDB : public TCWrap {
     }
 
     DEFINE_SYNC(Put)
-    DEFINE_ASYNC(Put)
+    DEFINE_ASYNC_QUEUED(Put)
 
     bool Putkeep(char *kbuf, int ksiz, char *vbuf, int vsiz) {
       return tcbdbputkeep(bdb, kbuf, ksiz, vbuf, vsiz);
@@ -1697,7 +3056,11 @@ class BDB : public TCWrap {
     }
 
     DEFINE_SYNC(Out)
-    DEFINE_ASYNC(Out)
+    DEFINE_ASYNC_QUEUED(Out)
+    DEFINE_SYNC(Putmany)
+    DEFINE_ASYNC(Putmany)
+    DEFINE_SYNC(Outmany)
+    DEFINE_ASYNC(Outmany)
 
     bool Outlist(char *kbuf, int ksiz) {
       return tcbdbout3(bdb, kbuf, ksiz);
@@ -1711,28 +3074,30 @@ class BDB : public TCWrap {
     }
 
     DEFINE_SYNC2(Get)
-    DEFINE_ASYNC2(Get)
+    DEFINE_ASYNC2_READ(Get)
+    DEFINE_SYNC2(Getmany)
+    DEFINE_ASYNC2_READ(Getmany)
 
     TCLIST * Getlist(char *kbuf, int ksiz) {
       return tcbdbget4(bdb, kbuf, ksiz);
     }
 
     DEFINE_SYNC2(Getlist)
-    DEFINE_ASYNC2(Getlist)
+    DEFINE_ASYNC2_READ(Getlist)
 
     int Vnum(char *kbuf, int ksiz) {
       return tcbdbvnum(bdb, kbuf, ksiz);
     }
 
     DEFINE_SYNC2(Vnum)
-    DEFINE_ASYNC2(Vnum)
+    DEFINE_ASYNC2_READ(Vnum)
 
     int Vsiz(char *kbuf, int ksiz) {
       return tcbdbvsiz(bdb, kbuf, ksiz);
     }
 
     DEFINE_SYNC2(Vsiz)
-    DEFINE_ASYNC2(Vsiz)
+    DEFINE_ASYNC2_READ(Vsiz)
 
     TCLIST * Range(char *bkbuf, int bksiz, bool binc, char *ekbuf, int eksiz, 
                                                       bool einc, int max) {
@@ -1741,10 +3106,10 @@ class BDB : public TCWrap {
 
     class RangeData : public virtual ArgsData {
       protected:
-        String::Utf8Value bkbuf;
+        ByteValue bkbuf;
         int bksiz;
         bool binc;
-        String::Utf8Value ekbuf;
+        ByteValue ekbuf;
         int eksiz;
         bool einc;
         int max;
@@ -1781,7 +3146,7 @@ class BDB : public TCWrap {
         Handle<Value>
         returnValue () {
           HandleScope scope;
-          return scope.Close(tclisttoary(list));
+          return scope.Close(tclisttoval(list, tcw->binary, tcw->packed));
         }
     };
 
@@ -1792,21 +3157,21 @@ class BDB : public TCWrap {
     };
 
     DEFINE_SYNC2(Range)
-    DEFINE_ASYNC2(Range)
+    DEFINE_ASYNC2_READ(Range)
 
     TCLIST * Fwmkeys(char *kbuf, int ksiz, int max) {
       return tcbdbfwmkeys(bdb, kbuf, ksiz, max);
     }
 
     DEFINE_SYNC2(Fwmkeys)
-    DEFINE_ASYNC2(Fwmkeys)
+    DEFINE_ASYNC2_READ(Fwmkeys)
 
     int Addint(char *kbuf, int ksiz, int num) {
       return tcbdbaddint(bdb, kbuf, ksiz, num);
     }
 
     DEFINE_SYNC2(Addint)
-    DEFINE_ASYNC2(Addint)
+    DEFINE_ASYNC2_QUEUED(Addint)
 
     double Adddouble(char *kbuf, int ksiz, double num) {
       return tcbdbadddouble(bdb, kbuf, ksiz, num);
@@ -1935,6 +3300,10 @@ class CUR : TCWrap {
       DEFINE_PREFIXED_CONSTANT(tmpl, BDB, CPBEFORE);
       DEFINE_PREFIXED_CONSTANT(tmpl, BDB, CPAFTER);
 
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setbinary", SetbinarySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setpacked", SetpackedSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "latencyStats", LatencyStatsSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setexternal", SetexternalSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "first", FirstSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "firstAsync", FirstAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "last", LastSync);
@@ -1953,6 +3322,10 @@ class CUR : TCWrap {
       NODE_SET_PROTOTYPE_METHOD(tmpl, "keyAsync", KeyAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "val", ValSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "valAsync", ValAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "read", ReadSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "readAsync", ReadAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "outrange", OutrangeSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "outrangeAsync", OutrangeAsync);
 
       target->Set(String::New("BDBCUR"), tmpl->GetFunction());
     }
@@ -1967,8 +3340,10 @@ class CUR : TCWrap {
           !BDB::Tmpl->HasInstance(args[0])) {
         return THROW_BAD_ARGS;
       }
-      TCBDB *bdb = ObjectWrap::Unwrap<BDB>(Local<Object>::Cast(args[0]))->bdb;
-      (new CUR(bdb))->Wrap(THIS);
+      BDB *bdb = ObjectWrap::Unwrap<BDB>(Local<Object>::Cast(args[0]));
+      CUR *cur = new CUR(bdb->bdb);
+      cur->Inherit(bdb);
+      cur->Wrap(THIS);
       return THIS;
     }
 
@@ -2081,120 +3456,626 @@ class CUR : TCWrap {
         }
     };
 
-    DEFINE_SYNC(Next)
+    DEFINE_SYNC(Next)
+
+    class NextAsyncData : public NextData, public AsyncData {
+      public:
+        NextAsyncData(const Arguments& args)
+          : AsyncData(args[0]), NextData(args), ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC(Next)
+
+    bool Put (char *kbuf, int ksiz, int cpmode) {
+      return tcbdbcurput(cur, kbuf, ksiz, cpmode);
+    }
+
+    class PutData : public KeyData {
+      private:
+        int cpmode;
+
+      public:
+        PutData(const Arguments& args) : KeyData(args), ArgsData(args) {
+          cpmode = NOU(args[1]) ?
+            BDBCPCURRENT : args[1]->Int32Value();
+        }
+
+        static bool checkArgs (const Arguments& args) {
+          return NOU(args[1]) || args[1]->IsNumber();
+        }
+
+        bool run () {
+          return tcw->Put(*kbuf, ksiz, cpmode);
+        }
+    };
+
+    DEFINE_SYNC(Put)
+
+    class PutAsyncData : public PutData, public AsyncData {
+      public:
+        PutAsyncData(const Arguments& args)
+          : AsyncData(args[2]), PutData(args), ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC(Put)
+
+    class OutData : public virtual ArgsData {
+      public:
+        OutData(const Arguments& args) : ArgsData(args) {}
+
+        bool run () {
+          return tcw->Out();
+        }
+    };
+
+    bool Out () {
+      return tcbdbcurout(cur);
+    }
+
+    DEFINE_SYNC(Out)
+
+    class OutAsyncData : public OutData, public AsyncData {
+      public:
+        OutAsyncData(const Arguments& args)
+          : AsyncData(args[0]), OutData(args), ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC(Out)
+
+    char * Key (int *vsiz_p) {
+      return static_cast<char *>(tcbdbcurkey(cur, vsiz_p));
+    }
+
+    // the key without copying it, valid until the cursor moves
+    const char * Key3 (int *vsiz_p) {
+      return static_cast<const char *>(tcbdbcurkey3(cur, vsiz_p));
+    }
+
+    class KeyData : public ValueData {
+      public:
+        KeyData(const Arguments& args) : ArgsData(args) {}
+
+        bool run () {
+          vbuf = tcw->Key(&vsiz);
+          return vbuf != NULL;
+        }
+    };
+
+    DEFINE_SYNC2(Key)
+
+    class KeyAsyncData : public KeyData, public AsyncData {
+      public:
+        KeyAsyncData(const Arguments& args)
+          : AsyncData(args[0]), KeyData(args), ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC2(Key)
+
+    char * Val (int *vsiz_p) {
+      return static_cast<char *>(tcbdbcurval(cur, vsiz_p));
+    }
+
+    class ValData : public ValueData {
+      public:
+        ValData(const Arguments& args) : ArgsData(args) {}
+
+        bool run () {
+          vbuf = tcw->Val(&vsiz);
+          return vbuf != NULL;
+        }
+    };
+
+    DEFINE_SYNC2(Val)
+
+    class ValAsyncData : public ValData, public AsyncData {
+      public:
+        ValAsyncData(const Arguments& args)
+          : AsyncData(args[0]), ValData(args), ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC2(Val)
+
+    bool Rec (TCXSTR *kxstr, TCXSTR *vxstr) {
+      return tcbdbcurrec(cur, kxstr, vxstr);
+    }
+
+    // Read records stepping the cursor up to n times
+    // arg[0] : maximum number of records
+    // arg[1] : true to step backward (prev) instead of forward (next)
+    // returns [keys, values]
+    class ReadData : public virtual ArgsData {
+      protected:
+        int max;
+        bool back;
+        TCLIST *keys;
+        TCLIST *vals;
+
+      public:
+        ReadData (const Arguments& args) : ArgsData(args) {
+          max = args[0]->Int32Value();
+          back = args[1]->BooleanValue();
+          keys = tclistnew2(max);
+          vals = tclistnew2(max);
+        }
+
+        ~ReadData () {
+          tclistdel(keys);
+          tclistdel(vals);
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return args[0]->IsNumber() && args[0]->Int32Value() > 0 &&
+            (NOU(args[1]) || args[1]->IsBoolean());
+        }
+
+        bool
+        run () {
+          TCXSTR *kxstr = tcxstrnew();
+          TCXSTR *vxstr = tcxstrnew();
+          while (tclistnum(keys) < max && tcw->Rec(kxstr, vxstr)) {
+            tclistpush(keys, tcxstrptr(kxstr), tcxstrsize(kxstr));
+            tclistpush(vals, tcxstrptr(vxstr), tcxstrsize(vxstr));
+            if (!(back ? tcw->Prev() : tcw->Next())) break;
+          }
+          tcxstrdel(kxstr);
+          tcxstrdel(vxstr);
+          return tclistnum(keys) > 0;
+        }
+
+        Handle<Value>
+        returnValue () {
+          HandleScope scope;
+          Local<Array> ary = Array::New(2);
+          ary->Set(0, tclisttoval(keys, tcw->binary, tcw->packed));
+          ary->Set(1, tclisttoval(vals, tcw->binary, tcw->packed));
+          return scope.Close(ary);
+        }
+    };
+
+    DEFINE_SYNC2(Read)
+
+    class ReadAsyncData : public ReadData, public AsyncData {
+      public:
+        ReadAsyncData (const Arguments& args)
+          : ReadData(args), AsyncData(args[2]), ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC2(Read)
+
+    // Remove records stepping the cursor up to n times
+    // arg[0] : maximum number of records
+    // arg[1] : true to step backward (prev) instead of forward (next)
+    // returns the number of removed records
+    class OutrangeData : public virtual ArgsData {
+      protected:
+        int max;
+        bool back;
+        int num;
+
+      public:
+        OutrangeData (const Arguments& args) : num(0), ArgsData(args) {
+          max = args[0]->Int32Value();
+          back = args[1]->BooleanValue();
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return args[0]->IsNumber() && args[0]->Int32Value() > 0 &&
+            (NOU(args[1]) || args[1]->IsBoolean());
+        }
+
+        bool
+        run () {
+          int ksiz;
+          while (num < max && tcw->Out()) {
+            num++;
+            if (!back) continue;
+            // tcbdbcurout moves the cursor to the next record, or makes it
+            // invalid when the removed record was the last one
+            if (static_cast<CUR *>(tcw)->Key3(&ksiz) != NULL) {
+              if (!tcw->Prev()) break;
+            } else if (!tcw->Last()) {
+              break;
+            }
+          }
+          return num > 0;
+        }
+
+        Handle<Value>
+        returnValue () {
+          HandleScope scope;
+          return scope.Close(Integer::New(num));
+        }
+    };
+
+    DEFINE_SYNC2(Outrange)
 
-    class NextAsyncData : public NextData, public AsyncData {
+    class OutrangeAsyncData : public OutrangeData, public AsyncData {
       public:
-        NextAsyncData(const Arguments& args)
-          : AsyncData(args[0]), NextData(args), ArgsData(args) {}
+        OutrangeAsyncData (const Arguments& args)
+          : OutrangeData(args), AsyncData(args[2]), ArgsData(args) {}
     };
 
-    DEFINE_ASYNC(Next)
+    DEFINE_ASYNC2(Outrange)
+};
 
-    bool Put (char *kbuf, int ksiz, int cpmode) {
-      return tcbdbcurput(cur, kbuf, ksiz, cpmode);
+// Readable stream over a key range of a B+ tree database, which inherits
+// stream.Stream so that it can be piped. Records are read in chunks of
+// highWaterMark records (not bytes) on the thread pool with a cursor of
+// its own, and a chunk is read only after the previous one has been
+// emitted, so a paused stream holds at most one chunk in memory.
+// The bounds are compared in the lexical order, the default comparator
+// of B+ tree databases (custom comparators are not exposed here).
+//   events : 'data' ({key, value}, or the key without values), 'end',
+//            'error' (ecode), 'close'
+class STM : TCWrap {
+  public:
+    STM (TCBDB *bdb_, const Handle<Object> opts) : bdb(bdb_), gte(NULL),
+        lt(NULL), started(false), ended(false), paused(false),
+        reading(false), destroyed(false), finished(false), pos(0),
+        err(TCESUCCESS) {
+      HandleScope scope;
+      cur = tcbdbcurnew(bdb);
+      reverse = optbool(opts, "reverse");
+      values = !opts->Has(String::NewSymbol("values")) ||
+        optbool(opts, "values");
+      Local<Value> val = opts->Get(String::NewSymbol("limit"));
+      limit = val->IsNumber() ? val->IntegerValue() : -1;
+      val = opts->Get(String::NewSymbol("highWaterMark"));
+      hwm = val->IsNumber() ? val->Int32Value() : 1024;
+      if (hwm < 1) hwm = 1;
+      val = opts->Get(String::NewSymbol("gte"));
+      if (!NOU(val)) {
+        ByteValue b(val);
+        gte = static_cast<char *>(tcmemdup(*b, b.length()));
+        gtesiz = b.length();
+      }
+      val = opts->Get(String::NewSymbol("lt"));
+      if (!NOU(val)) {
+        ByteValue b(val);
+        lt = static_cast<char *>(tcmemdup(*b, b.length()));
+        ltsiz = b.length();
+      }
+      keys = tclistnew2(hwm);
+      vals = tclistnew2(hwm);
+      ev_prepare_init(&pump, Pump);
+      pump.data = this;
     }
 
-    class PutData : public KeyData {
-      private:
-        int cpmode;
-
-      public:
-        PutData(const Arguments& args) : KeyData(args), ArgsData(args) {
-          cpmode = NOU(args[1]) ?
-            BDBCPCURRENT : args[1]->Int32Value();
-        }
+    ~STM () {
+      tcbdbcurdel(cur);
+      if (gte != NULL) tcfree(gte);
+      if (lt != NULL) tcfree(lt);
+      tclistdel(keys);
+      tclistdel(vals);
+      db.Dispose();
+    }
 
-        static bool checkArgs (const Arguments& args) {
-          return NOU(args[1]) || args[1]->IsNumber();
-        }
+    const static Persistent<FunctionTemplate> Tmpl;
 
-        bool run () {
-          return tcw->Put(*kbuf, ksiz, cpmode);
-        }
-    };
+    static void
+    Initialize (const Handle<Object> target) {
+      HandleScope scope;
+      Tmpl->Inherit(EventEmitter::constructor_template);
+      Tmpl->InstanceTemplate()->SetInternalFieldCount(1);
 
-    DEFINE_SYNC(Put)
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "pause", Pause);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "resume", Resume);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "destroy", Destroy);
 
-    class PutAsyncData : public PutData, public AsyncData {
-      public:
-        PutAsyncData(const Arguments& args)
-          : AsyncData(args[2]), PutData(args), ArgsData(args) {}
-    };
+      Local<Function> ctor = Tmpl->GetFunction();
+      Local<Value> sproto = StreamPrototype();
+      if (sproto->IsObject()) {
+        // stream.Stream.prototype inherits EventEmitter.prototype as well
+        ctor->Get(String::NewSymbol("prototype"))->ToObject()->
+          SetPrototype(sproto);
+      }
+      target->Set(String::New("BDBSTREAM"), ctor);
+    }
 
-    DEFINE_ASYNC(Put)
+  private:
+    TCBDB *bdb;
+    BDBCUR *cur;
+    // keeps the database alive while the stream is open
+    Persistent<Object> db;
+    char *gte;
+    int gtesiz;
+    char *lt;
+    int ltsiz;
+    bool reverse;
+    bool values;
+    int64_t limit;
+    int hwm;
+    bool started;
+    bool ended;
+    bool paused;
+    bool reading;
+    bool destroyed;
+    bool finished;
+    // the chunk being emitted
+    TCLIST *keys;
+    TCLIST *vals;
+    int pos;
+    int err;
+    ev_prepare pump;
+
+    static STM *
+    Unwrap (const Handle<Object> obj) {
+      return ObjectWrap::Unwrap<STM>(obj);
+    }
 
-    class OutData : public virtual ArgsData {
-      public:
-        OutData(const Arguments& args) : ArgsData(args) {}
+    // stream.Stream.prototype, looked up through the main module since an
+    // addon is not given require (undefined in the REPL, where the stream
+    // is a plain EventEmitter without pipe)
+    static Handle<Value>
+    StreamPrototype () {
+      HandleScope scope;
+      Local<Object> global = Context::GetCurrent()->Global();
+      Local<Value> process = global->Get(String::NewSymbol("process"));
+      if (!process->IsObject()) return Undefined();
+      Local<Value> main =
+        process->ToObject()->Get(String::NewSymbol("mainModule"));
+      if (!main->IsObject()) return Undefined();
+      Local<Value> require =
+        main->ToObject()->Get(String::NewSymbol("require"));
+      if (!require->IsFunction()) return Undefined();
+      TryCatch try_catch;
+      Handle<Value> argv[1] = {String::New("stream")};
+      Local<Value> mod =
+        Local<Function>::Cast(require)->Call(main->ToObject(), 1, argv);
+      if (try_catch.HasCaught() || !mod->IsObject()) return Undefined();
+      Local<Value> ctor = mod->ToObject()->Get(String::NewSymbol("Stream"));
+      if (!ctor->IsFunction()) return Undefined();
+      return scope.Close(
+          ctor->ToObject()->Get(String::NewSymbol("prototype")));
+    }
+
+    // arg[0] : BDB object
+    // arg[1] : options {gte, lt, reverse, limit, values, highWaterMark}
+    static Handle<Value>
+    New (const Arguments& args) {
+      HandleScope scope;
+      if (args.Length() < 1 || !BDB::Tmpl->HasInstance(args[0]) ||
+          !(NOU(args[1]) || args[1]->IsObject())) {
+        return THROW_BAD_ARGS;
+      }
+      Local<Object> dbobj = Local<Object>::Cast(args[0]);
+      BDB *bdb = ObjectWrap::Unwrap<BDB>(dbobj);
+      Local<Object> opts = args[1]->IsObject() ?
+        args[1]->ToObject() : Object::New();
+      STM *stm = new STM(bdb->bdb, opts);
+      stm->Inherit(bdb);
+      stm->db = Persistent<Object>::New(dbobj);
+      stm->Wrap(THIS);
+      THIS->Set(String::NewSymbol("readable"), True());
+      // released when the stream ends or is destroyed
+      stm->Ref();
+      // start reading once the listeners are attached
+      ev_prepare_start(EV_DEFAULT_UC, &stm->pump);
+      return THIS;
+    }
 
-        bool run () {
-          return tcw->Out();
-        }
-    };
+    static Handle<Value>
+    Pause (const Arguments& args) {
+      HandleScope scope;
+      Unwrap(THIS)->paused = true;
+      return Undefined();
+    }
 
-    bool Out () {
-      return tcbdbcurout(cur);
+    static Handle<Value>
+    Resume (const Arguments& args) {
+      HandleScope scope;
+      STM *stm = Unwrap(THIS);
+      stm->paused = false;
+      if (!stm->finished && !stm->reading &&
+          !ev_is_active(&stm->pump)) {
+        ev_prepare_start(EV_DEFAULT_UC, &stm->pump);
+      }
+      return Undefined();
     }
 
-    DEFINE_SYNC(Out)
+    static Handle<Value>
+    Destroy (const Arguments& args) {
+      HandleScope scope;
+      STM *stm = Unwrap(THIS);
+      if (stm->finished || stm->destroyed) return Undefined();
+      stm->destroyed = true;
+      // an outstanding read finishes the stream when it comes back
+      if (!stm->reading) stm->Close();
+      return Undefined();
+    }
 
-    class OutAsyncData : public OutData, public AsyncData {
-      public:
-        OutAsyncData(const Arguments& args)
-          : AsyncData(args[0]), OutData(args), ArgsData(args) {}
-    };
+    void
+    Emit (int argc, Handle<Value> argv[]) {
+      HandleScope scope;
+      Local<Value> emit = handle_->Get(String::NewSymbol("emit"));
+      if (!emit->IsFunction()) return;
+      TryCatch try_catch;
+      Local<Function>::Cast(emit)->Call(handle_, argc, argv);
+      if (try_catch.HasCaught()) {
+        FatalException(try_catch);
+      }
+    }
 
-    DEFINE_ASYNC(Out)
+    void
+    Finish () {
+      if (finished) return;
+      finished = true;
+      if (ev_is_active(&pump)) ev_prepare_stop(EV_DEFAULT_UC, &pump);
+      handle_->Set(String::NewSymbol("readable"), False());
+    }
 
-    char * Key (int *vsiz_p) {
-      return static_cast<char *>(tcbdbcurkey(cur, vsiz_p));
+    // the last event, after 'end', 'error' or destroy
+    void
+    Close () {
+      HandleScope scope;
+      Finish();
+      Handle<Value> argv[1] = {String::NewSymbol("close")};
+      Emit(1, argv);
+      Unref();
     }
 
-    class KeyData : public ValueData {
-      public:
-        KeyData(const Arguments& args) : ArgsData(args) {}
+    static void
+    Pump (EV_P_ ev_prepare *watcher, int revents) {
+      STM *stm = static_cast<STM *>(watcher->data);
+      ev_prepare_stop(EV_DEFAULT_UC, watcher);
+      stm->Flow();
+    }
 
-        bool run () {
-          vbuf = tcw->Key(&vsiz);
-          return vbuf != NULL;
-        }
-    };
+    // emits buffered records until paused, then reads the next chunk
+    void
+    Flow () {
+      HandleScope scope;
+      Local<String> data = String::NewSymbol("data");
+      Local<String> key = String::NewSymbol("key");
+      Local<String> value = String::NewSymbol("value");
+      while (!paused && !finished && pos < tclistnum(keys)) {
+        int ksiz, vsiz;
+        const char *kbuf =
+          static_cast<const char *>(tclistval(keys, pos, &ksiz));
+        Handle<Value> argv[2];
+        argv[0] = data;
+        if (values) {
+          const char *vbuf =
+            static_cast<const char *>(tclistval(vals, pos, &vsiz));
+          Local<Object> rec = Object::New();
+          rec->Set(key, bytestoval(kbuf, ksiz, binary));
+          rec->Set(value, bytestoval(vbuf, vsiz, binary));
+          argv[1] = rec;
+        } else {
+          argv[1] = bytestoval(kbuf, ksiz, binary);
+        }
+        pos++;
+        Emit(2, argv);
+      }
+      if (paused || finished || reading || pos < tclistnum(keys)) return;
+      if (err != TCESUCCESS) {
+        Handle<Value> argv[2] = {String::NewSymbol("error"),
+                                 Integer::New(err)};
+        Finish();
+        Emit(2, argv);
+        Close();
+      } else if (ended) {
+        Handle<Value> argv[1] = {String::NewSymbol("end")};
+        Finish();
+        Emit(1, argv);
+        Close();
+      } else {
+        Read();
+      }
+    }
 
-    DEFINE_SYNC2(Key)
+    void
+    Read () {
+      tclistclear(keys);
+      tclistclear(vals);
+      pos = 0;
+      reading = true;
+      Dispatch(ExecRead, AfterRead, this, true);
+      ev_ref(EV_DEFAULT_UC);
+    }
 
-    class KeyAsyncData : public KeyData, public AsyncData {
-      public:
-        KeyAsyncData(const Arguments& args)
-          : AsyncData(args[0]), KeyData(args), ArgsData(args) {}
-    };
+    static int
+    ExecRead (eio_req *req) {
+      static_cast<STM *>(req->data)->Fill();
+      return 0;
+    }
 
-    DEFINE_ASYNC2(Key)
+    static int
+    AfterRead (eio_req *req) {
+      STM *stm = static_cast<STM *>(req->data);
+      ev_unref(EV_DEFAULT_UC);
+      stm->reading = false;
+      if (stm->destroyed) {
+        stm->Close();
+      } else {
+        stm->Flow();
+      }
+      return 0;
+    }
 
-    char * Val (int *vsiz_p) {
-      return static_cast<char *>(tcbdbcurval(cur, vsiz_p));
+    // compares a key with a bound in the default order of the database
+    static int
+    Compare (const char *kbuf, int ksiz, const char *bbuf, int bsiz) {
+      return tccmplexical(kbuf, ksiz, bbuf, bsiz, NULL);
     }
 
-    class ValData : public ValueData {
-      public:
-        ValData(const Arguments& args) : ArgsData(args) {}
+    // the end of the range is reported as ENOREC by the cursor
+    void
+    Stop (bool ok) {
+      ended = true;
+      if (!ok) {
+        int ecode = tcbdbecode(bdb);
+        if (ecode != TCENOREC) err = ecode;
+      }
+    }
 
-        bool run () {
-          vbuf = tcw->Val(&vsiz);
-          return vbuf != NULL;
+    // runs in a worker thread
+    void
+    Fill () {
+      if (ended) return;
+      bool ok;
+      if (!started) {
+        started = true;
+        if (reverse) {
+          // the last record before lt is the one before the first record
+          // at or after it (or the last one if there is none)
+          if (lt != NULL && tcbdbcurjump(cur, lt, ltsiz)) {
+            ok = tcbdbcurprev(cur);
+          } else {
+            ok = tcbdbcurlast(cur);
+          }
+        } else {
+          ok = gte != NULL ? tcbdbcurjump(cur, gte, gtesiz) :
+                             tcbdbcurfirst(cur);
         }
-    };
-
-    DEFINE_SYNC2(Val)
+        if (!ok) return Stop(false);
+      }
+      TCXSTR *kxstr = tcxstrnew();
+      TCXSTR *vxstr = tcxstrnew();
+      while (tclistnum(keys) < hwm) {
+        if (limit == 0) {
+          Stop(true);
+          break;
+        }
+        if (!tcbdbcurrec(cur, kxstr, vxstr)) {
+          Stop(false);
+          break;
+        }
+        const char *kbuf = static_cast<const char *>(tcxstrptr(kxstr));
+        int ksiz = tcxstrsize(kxstr);
+        // the cursor started at the other bound
+        if (reverse ? gte != NULL && Compare(kbuf, ksiz, gte, gtesiz) < 0 :
+                      lt != NULL && Compare(kbuf, ksiz, lt, ltsiz) >= 0) {
+          Stop(true);
+          break;
+        }
+        tclistpush(keys, kbuf, ksiz);
+        if (values) {
+          tclistpush(vals, tcxstrptr(vxstr), tcxstrsize(vxstr));
+        }
+        if (limit > 0) limit--;
+        if (!(reverse ? tcbdbcurprev(cur) : tcbdbcurnext(cur))) {
+          Stop(false);
+          break;
+        }
+      }
+      tcxstrdel(kxstr);
+      tcxstrdel(vxstr);
+    }
+};
 
-    class ValAsyncData : public ValData, public AsyncData {
-      public:
-        ValAsyncData(const Arguments& args)
-          : AsyncData(args[0]), ValData(args), ArgsData(args) {}
-    };
+const Persistent<FunctionTemplate> STM::Tmpl =
+  Persistent<FunctionTemplate>::New(FunctionTemplate::New(STM::New));
 
-    DEFINE_ASYNC2(Val)
-};
+// bdb.createReadStream(opts) is a shorthand of new BDBSTREAM(bdb, opts)
+Handle<Value>
+BDB::CreateReadStream (const Arguments& args) {
+  HandleScope scope;
+  Handle<Value> argv[2] = {THIS, args[0]};
+  return scope.Close(STM::Tmpl->GetFunction()->NewInstance(2, argv));
+}
 
 class FDB : public TCWrap {
   public:
@@ -2224,6 +4105,12 @@ class FDB : public TCWrap {
       NODE_SET_PROTOTYPE_METHOD(tmpl, "errmsg", ErrmsgSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "ecode", EcodeSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "setmutex", SetmutexSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setserial", SetserialSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setbinary", SetbinarySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setpacked", SetpackedSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setexternal", SetexternalSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setcoalesce", SetcoalesceSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "latencyStats", LatencyStatsSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "tune", TuneSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "open", OpenSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "openAsync", OpenAsync);
@@ -2237,14 +4124,22 @@ class FDB : public TCWrap {
       NODE_SET_PROTOTYPE_METHOD(tmpl, "putcatAsync", PutcatAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "out", OutSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "outAsync", OutAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "putmany", PutmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "putmanyAsync", PutmanyAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "outmany", OutmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "outmanyAsync", OutmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "get", GetSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "getAsync", GetAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "getmany", GetmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "getmanyAsync", GetmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "vsiz", VsizSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "vsizAsync", VsizAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iterinit", IterinitSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iterinitAsync", IterinitAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iternext", IternextSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iternextAsync", IternextAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "iternextmany", IternextmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "iternextmanyAsync", IternextmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "range", RangeSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "rangeAsync", RangeAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "addint", AddintSync);
@@ -2375,7 +4270,7 @@ class FDB : public TCWrap {
     }
 
     DEFINE_SYNC(Put)
-    DEFINE_ASYNC(Put)
+    DEFINE_ASYNC_QUEUED(Put)
 
     bool Putkeep(char *kbuf, int ksiz, char *vbuf, int vsiz) {
       return tcfdbputkeep2(fdb, kbuf, ksiz, vbuf, vsiz);
@@ -2396,21 +4291,27 @@ class FDB : public TCWrap {
     }
 
     DEFINE_SYNC(Out)
-    DEFINE_ASYNC(Out)
+    DEFINE_ASYNC_QUEUED(Out)
+    DEFINE_SYNC(Putmany)
+    DEFINE_ASYNC(Putmany)
+    DEFINE_SYNC(Outmany)
+    DEFINE_ASYNC(Outmany)
 
     char * Get(char *kbuf, int ksiz, int *vsiz_p) {
       return static_cast<char *>(tcfdbget2(fdb, kbuf, ksiz, vsiz_p));
     }
 
     DEFINE_SYNC2(Get)
-    DEFINE_ASYNC2(Get)
+    DEFINE_ASYNC2_READ(Get)
+    DEFINE_SYNC2(Getmany)
+    DEFINE_ASYNC2_READ(Getmany)
 
     int Vsiz(char *kbuf, int ksiz) {
       return tcfdbvsiz2(fdb, kbuf, ksiz);
     }
 
     DEFINE_SYNC2(Vsiz)
-    DEFINE_ASYNC2(Vsiz)
+    DEFINE_ASYNC2_READ(Vsiz)
 
     bool Iterinit () {
       return tcfdbiterinit(fdb);
@@ -2425,6 +4326,8 @@ class FDB : public TCWrap {
 
     DEFINE_SYNC2(Iternext)
     DEFINE_ASYNC2(Iternext)
+    DEFINE_SYNC2(Iternextmany)
+    DEFINE_ASYNC2(Iternextmany)
 
     TCLIST * Range(char *ibuf, int isiz, int max) {
       return tcfdbrange4(fdb, ibuf, isiz, max);
@@ -2457,18 +4360,18 @@ class FDB : public TCWrap {
     class RangeAsyncData : public RangeData, public AsyncData {
       public:
         RangeAsyncData (const Arguments& args)
-          : RangeData(args), AsyncData(args[5]), ArgsData(args) {}
+          : RangeData(args), AsyncData(args[2]), ArgsData(args) {}
     };
 
     DEFINE_SYNC2(Range)
-    DEFINE_ASYNC2(Range)
+    DEFINE_ASYNC2_READ(Range)
 
     int Addint(char *kbuf, int ksiz, int num) {
       return tcfdbaddint(fdb, tcfdbkeytoid(kbuf, ksiz), num);
     }
 
     DEFINE_SYNC2(Addint)
-    DEFINE_ASYNC2(Addint)
+    DEFINE_ASYNC2_QUEUED(Addint)
 
     double Adddouble(char *kbuf, int ksiz, double num) {
       return tcfdbadddouble(fdb, tcfdbkeytoid(kbuf, ksiz), num);
@@ -2567,6 +4470,9 @@ class TDB : public TCWrap {
 
     const static Persistent<FunctionTemplate> Tmpl;
 
+    // symbols of the column names (see Colnames)
+    Colnames names;
+
     TDB () {
       tdb = tctdbnew();
     }
@@ -2603,6 +4509,11 @@ class TDB : public TCWrap {
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "errmsg", ErrmsgSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "ecode", EcodeSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "setmutex", SetmutexSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setserial", SetserialSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setbinary", SetbinarySync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setpacked", SetpackedSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setcoalesce", SetcoalesceSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "latencyStats", LatencyStatsSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "tune", TuneSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "setcache", SetcacheSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "setxmsiz", SetxmsizSync);
@@ -2619,14 +4530,22 @@ class TDB : public TCWrap {
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "putcatAsync", PutcatAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "out", OutSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "outAsync", OutAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "putmany", PutmanySync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "putmanyAsync", PutmanyAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "outmany", OutmanySync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "outmanyAsync", OutmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "get", GetSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "getAsync", GetAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "getmany", GetmanySync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "getmanyAsync", GetmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "vsiz", VsizSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "vsizAsync", VsizAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "iterinit", IterinitSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "iterinitAsync", IterinitAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "iternext", IternextSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "iternextAsync", IternextAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "iternextmany", IternextmanySync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "iternextmanyAsync", IternextmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "fwmkeys", FwmkeysSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "fwmkeysAsync", FwmkeysAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "addint", AddintSync);
@@ -2653,12 +4572,19 @@ class TDB : public TCWrap {
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "setindex", SetindexSync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "setindexAsync", SetindexAsync);
       NODE_SET_PROTOTYPE_METHOD(Tmpl, "genuid", Genuid);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "prepare", Prepare);
+      Tmpl->Set(String::NewSymbol("metasearchParallel"),
+                FunctionTemplate::New(MetasearchParallel));
 
       target->Set(String::New("TDB"), Tmpl->GetFunction());
     }
 
   private:
 
+    // defined after QRY
+    static Handle<Value> Prepare (const Arguments& args);
+    static Handle<Value> MetasearchParallel (const Arguments& args);
+
     static Handle<Value>
     New (const Arguments& args) {
       HandleScope scope;
@@ -2838,7 +4764,7 @@ class TDB : public TCWrap {
           : PutData(args), AsyncData(args[2]), ArgsData(args) {}
     };
 
-    DEFINE_ASYNC(Put)
+    DEFINE_ASYNC_QUEUED(Put)
 
     bool Putkeep(char *kbuf, int ksiz, TCMAP *map) {
       return tctdbputkeep(tdb, kbuf, ksiz, map);
@@ -2891,32 +4817,122 @@ class TDB : public TCWrap {
     }
 
     DEFINE_SYNC(Out)
-    DEFINE_ASYNC(Out)
+    DEFINE_ASYNC_QUEUED(Out)
+
+    class PutmanyData : public virtual ArgsData {
+      protected:
+        TCLIST *keys;
+        TCMAP **maps;
+        int num;
+        bool tx;
+
+      public:
+        PutmanyData (const Arguments& args) : ArgsData(args) {
+          HandleScope scope;
+          Local<Array> ary = Local<Array>::Cast(args[0]);
+          Local<Array> pair;
+          num = ary->Length();
+          keys = tclistnew2(num);
+          maps = static_cast<TCMAP **>(tccalloc(num + 1, sizeof(*maps)));
+          for (int i = 0; i < num; i++) {
+            pair = Local<Array>::Cast(ary->Get(i));
+            ByteValue kbuf(pair->Get(0));
+            tclistpush(keys, *kbuf, kbuf.length());
+            maps[i] = objtotcmap(Local<Object>::Cast(pair->Get(1)));
+          }
+          tx = optbool(args[1], "tx");
+        }
+
+        ~PutmanyData () {
+          for (int i = 0; i < num; i++) {
+            tcmapdel(maps[i]);
+          }
+          tcfree(maps);
+          tclistdel(keys);
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          HandleScope scope;
+          if (!ispairary(args[0]) || !(NOU(args[1]) || args[1]->IsObject())) {
+            return false;
+          }
+          Local<Array> ary = Local<Array>::Cast(args[0]);
+          int len = ary->Length();
+          for (int i = 0; i < len; i++) {
+            Local<Array> pair = Local<Array>::Cast(ary->Get(i));
+            if (!pair->Get(1)->IsObject()) return false;
+          }
+          return true;
+        }
+
+        bool
+        run () {
+          if (tx && !tcw->Tranbegin()) return false;
+          bool ok = true;
+          int ksiz;
+          for (int i = 0; ok && i < num; i++) {
+            const void *kbuf = tclistval(keys, i, &ksiz);
+            ok = tcw->Put(static_cast<char *>(const_cast<void *>(kbuf)), ksiz,
+                          maps[i]);
+          }
+          return tx ? endtran(ok) : ok;
+        }
+    };
+
+    DEFINE_SYNC(Putmany)
+
+    class PutmanyAsyncData : public PutmanyData, public AsyncData {
+      public:
+        // options may be left out before the callback
+        PutmanyAsyncData (const Arguments& args)
+          : PutmanyData(args),
+            AsyncData(args[1]->IsFunction() ? args[1] : args[2]),
+            ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC(Putmany)
+    DEFINE_SYNC(Outmany)
+    DEFINE_ASYNC(Outmany)
 
     TCMAP * Get(char *kbuf, int ksiz) {
       return tctdbget(tdb, kbuf, ksiz);
     }
 
+    static Colnames *
+    Names (TCWrap *tcw) {
+      return &static_cast<TDB *>(tcw)->names;
+    }
+
+    // arg[1] : options ({columns: [...]} to get only these columns)
     class GetData : public KeyData {
       protected:
         TCMAP *map;
+        TCLIST *cols;
 
       public:
-        GetData (const Arguments& args) : KeyData(args), ArgsData(args) {}
+        GetData (const Arguments& args) : KeyData(args), ArgsData(args) {
+          map = NULL;
+          cols = optcolumns(args[1]);
+        }
 
         ~GetData () {
-          tcmapdel(map);
+          if (map != NULL) tcmapdel(map);
+          if (cols != NULL) tclistdel(cols);
         }
 
         bool run () {
           map = tcw->Get(*kbuf, ksiz);
+          if (map != NULL && cols != NULL) map = tcmapproject(map, cols);
           return map != NULL;
         }
 
         Handle<Value>
         returnValue () {
           HandleScope scope;
-          return scope.Close(tcmaptoobj(map));
+          // no such record
+          if (map == NULL) return Null();
+          return scope.Close(tcmaptoobj(map, Names(tcw)));
         }
     };
 
@@ -2924,18 +4940,80 @@ class TDB : public TCWrap {
 
     class GetAsyncData : public GetData, public AsyncData {
       public:
+        // options may be left out before the callback
         GetAsyncData (const Arguments& args)
-          : GetData(args), AsyncData(args[1]), ArgsData(args) {}
+          : GetData(args),
+            AsyncData(args[1]->IsFunction() ? args[1] : args[2]),
+            ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC2_READ(Get)
+
+    // arg[1] : options ({columns: [...]} to get only these columns)
+    class GetmanyData : public KeylistData {
+      protected:
+        TCMAP **maps;
+        TCLIST *cols;
+
+      public:
+        GetmanyData (const Arguments& args) : KeylistData(args), ArgsData(args) {
+          maps = static_cast<TCMAP **>(tccalloc(knum + 1, sizeof(*maps)));
+          cols = optcolumns(args[1]);
+        }
+
+        ~GetmanyData () {
+          for (int i = 0; i < knum; i++) {
+            if (maps[i] != NULL) tcmapdel(maps[i]);
+          }
+          tcfree(maps);
+          if (cols != NULL) tclistdel(cols);
+        }
+
+        bool
+        run () {
+          char *kbuf;
+          int ksiz;
+          for (int i = 0; i < knum; i++) {
+            kbuf = key(i, &ksiz);
+            maps[i] = tcw->Get(kbuf, ksiz);
+            if (maps[i] != NULL && cols != NULL) {
+              maps[i] = tcmapproject(maps[i], cols);
+            }
+          }
+          return true;
+        }
+
+        Handle<Value>
+        returnValue () {
+          HandleScope scope;
+          Colnames *names = Names(tcw);
+          Local<Array> ary = Array::New(knum);
+          for (int i = 0; i < knum; i++) {
+            ary->Set(i, maps[i] == NULL ? Handle<Value>(Null()) :
+                Handle<Value>(tcmaptoobj(maps[i], names)));
+          }
+          return scope.Close(ary);
+        }
+    };
+
+    DEFINE_SYNC2(Getmany)
+
+    class GetmanyAsyncData : public GetmanyData, public AsyncData {
+      public:
+        GetmanyAsyncData (const Arguments& args)
+          : GetmanyData(args),
+            AsyncData(args[1]->IsFunction() ? args[1] : args[2]),
+            ArgsData(args) {}
     };
 
-    DEFINE_ASYNC2(Get)
+    DEFINE_ASYNC2_READ(Getmany)
 
     int Vsiz(char *kbuf, int ksiz) {
       return tctdbvsiz(tdb, kbuf, ksiz);
     }
 
     DEFINE_SYNC2(Vsiz)
-    DEFINE_ASYNC2(Vsiz)
+    DEFINE_ASYNC2_READ(Vsiz)
 
     bool Iterinit () {
       return tctdbiterinit(tdb);
@@ -2948,22 +5026,109 @@ class TDB : public TCWrap {
       return static_cast<char *>(tctdbiternext(tdb, vsiz_p));
     }
 
-    DEFINE_SYNC2(Iternext)
-    DEFINE_ASYNC2(Iternext)
+    DEFINE_SYNC2(Iternext)
+    DEFINE_ASYNC2(Iternext)
+
+    class IternextmanyData : public virtual ArgsData {
+      protected:
+        int max;
+        bool values;
+        TCLIST *keys;
+        TCPTRLIST *maps;
+
+      public:
+        IternextmanyData (const Arguments& args) : ArgsData(args) {
+          max = args[0]->Int32Value();
+          values = optbool(args[1], "values");
+          keys = tclistnew2(max > 0 ? max : 1);
+          maps = values ? tcptrlistnew2(max > 0 ? max : 1) : NULL;
+        }
+
+        ~IternextmanyData () {
+          tclistdel(keys);
+          if (maps != NULL) {
+            for (int i = 0; i < tcptrlistnum(maps); i++) {
+              tcmapdel(static_cast<TCMAP *>(tcptrlistval(maps, i)));
+            }
+            tcptrlistdel(maps);
+          }
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return args[0]->IsNumber() && args[0]->Int32Value() > 0 &&
+            (NOU(args[1]) || args[1]->IsObject());
+        }
+
+        bool
+        run () {
+          char *kbuf;
+          int ksiz;
+          TCMAP *map;
+          while (tclistnum(keys) < max) {
+            kbuf = tcw->Iternext(&ksiz);
+            if (kbuf == NULL) break;
+            if (values) {
+              map = tcw->Get(kbuf, ksiz);
+              if (map != NULL) {
+                tclistpush(keys, kbuf, ksiz);
+                tcptrlistpush(maps, map);
+              }
+            } else {
+              tclistpush(keys, kbuf, ksiz);
+            }
+            tcfree(kbuf);
+          }
+          return tclistnum(keys) > 0;
+        }
+
+        Handle<Value>
+        returnValue () {
+          HandleScope scope;
+          Local<Array> ary = Array::New(2);
+          ary->Set(0, tclisttoval(keys, tcw->binary, tcw->packed));
+          if (values) {
+            int num = tcptrlistnum(maps);
+            Colnames *names = Names(tcw);
+            Local<Array> rows = Array::New(num);
+            for (int i = 0; i < num; i++) {
+              rows->Set(i, tcmaptoobj(
+                    static_cast<TCMAP *>(tcptrlistval(maps, i)), names));
+            }
+            ary->Set(1, rows);
+          } else {
+            ary->Set(1, Null());
+          }
+          return scope.Close(ary);
+        }
+    };
+
+    DEFINE_SYNC2(Iternextmany)
+
+    class IternextmanyAsyncData : public IternextmanyData, public AsyncData {
+      public:
+        // options may be left out before the callback
+        IternextmanyAsyncData (const Arguments& args)
+          : IternextmanyData(args),
+            AsyncData(args[1]->IsFunction() ? args[1] : args[2]),
+            ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC2(Iternextmany)
 
     TCLIST * Fwmkeys(char *kbuf, int ksiz, int max) {
       return tctdbfwmkeys(tdb, kbuf, ksiz, max);
     }
 
     DEFINE_SYNC2(Fwmkeys)
-    DEFINE_ASYNC2(Fwmkeys)
+    DEFINE_ASYNC2_READ(Fwmkeys)
 
     int Addint(char *kbuf, int ksiz, int num) {
       return tctdbaddint(tdb, kbuf, ksiz, num);
     }
 
     DEFINE_SYNC2(Addint)
-    DEFINE_ASYNC2(Addint)
+    DEFINE_ASYNC2_QUEUED(Addint)
 
     double Adddouble(char *kbuf, int ksiz, double num) {
       return tctdbadddouble(tdb, kbuf, ksiz, num);
@@ -3102,12 +5267,180 @@ const Persistent<FunctionTemplate> TDB::Tmpl =
 
 class QRY : TCWrap {
   public:
-    QRY (TCTDB *db) {
+    // Conditions, order and limit of a prepared query. Conditions whose
+    // expression is "?" take the parameters given to bind in order, and
+    // the queries compiled for each set of parameters are kept in an LRU
+    // cache, so that binding the same values again costs a lookup.
+    class Prepared {
+      private:
+        TCTDB *tdb;
+        int cnum;
+        TCLIST *names;
+        int *ops;
+        TCLIST *exprs;
+        char *oname;
+        int otype;
+        int lmax;
+        int lskip;
+        // parameters -> TDBQRY *; not shared with other queries, as
+        // tctdbqrysearch writes to the TDBQRY it runs
+        TCMAP *cache;
+        int cachemax;
+
+        TDBQRY *
+        compile (const TCLIST *params) {
+          TDBQRY *qry = tctdbqrynew(tdb);
+          int pi = 0;
+          for (int i = 0; i < cnum; i++) {
+            const char *expr = tclistval2(exprs, i);
+            if (strcmp(expr, "?") == 0) expr = tclistval2(params, pi++);
+            tctdbqryaddcond(qry, tclistval2(names, i), ops[i], expr);
+          }
+          if (oname != NULL) tctdbqrysetorder(qry, oname, otype);
+          tctdbqrysetlimit(qry, lmax, lskip);
+          return qry;
+        }
+
+      public:
+        int pnum;
+
+        // spec : {conds: [[name, op, expr], ...], order: [name, type],
+        //         limit: [max, skip], cache: size}
+        Prepared (TCTDB *tdb_, const Handle<Object> spec) : tdb(tdb_) {
+          HandleScope scope;
+          Local<Value> val = spec->Get(String::NewSymbol("conds"));
+          Local<Array> conds = val->IsArray() ?
+            Local<Array>::Cast(val) : Array::New(0);
+          cnum = conds->Length();
+          names = tclistnew2(cnum);
+          exprs = tclistnew2(cnum);
+          ops = static_cast<int *>(tcmalloc(sizeof(*ops) * (cnum + 1)));
+          pnum = 0;
+          for (int i = 0; i < cnum; i++) {
+            Local<Array> cond = Local<Array>::Cast(conds->Get(i));
+            String::Utf8Value name(cond->Get(0));
+            String::Utf8Value expr(cond->Get(2));
+            tclistpush2(names, *name);
+            tclistpush2(exprs, *expr);
+            ops[i] = cond->Get(1)->Int32Value();
+            if (strcmp(*expr, "?") == 0) pnum++;
+          }
+          oname = NULL;
+          val = spec->Get(String::NewSymbol("order"));
+          if (val->IsArray()) {
+            Local<Array> order = Local<Array>::Cast(val);
+            oname = tcstrdup(*String::Utf8Value(order->Get(0)));
+            Local<Value> type = order->Get(1);
+            otype = NOU(type) ? TDBQOSTRASC : type->Int32Value();
+          }
+          lmax = -1;
+          lskip = -1;
+          val = spec->Get(String::NewSymbol("limit"));
+          if (val->IsArray()) {
+            Local<Array> limit = Local<Array>::Cast(val);
+            lmax = limit->Get(0)->Int32Value();
+            lskip = limit->Get(1)->Int32Value();
+          }
+          val = spec->Get(String::NewSymbol("cache"));
+          cachemax = val->IsNumber() ? val->Int32Value() : 64;
+          if (cachemax < 1) cachemax = 1;
+          cache = tcmapnew();
+        }
+
+        ~Prepared () {
+          tclistdel(names);
+          tclistdel(exprs);
+          tcfree(ops);
+          if (oname != NULL) tcfree(oname);
+          const char *kbuf;
+          int ksiz;
+          tcmapiterinit(cache);
+          while ((kbuf = static_cast<const char *>(
+                      tcmapiternext(cache, &ksiz))) != NULL) {
+            int vsiz;
+            TDBQRY *qry;
+            memcpy(&qry, tcmapiterval(kbuf, &vsiz), sizeof(qry));
+            tctdbqrydel(qry);
+          }
+          tcmapdel(cache);
+        }
+
+        static bool
+        checkSpec (const Handle<Value> spec) {
+          HandleScope scope;
+          if (!spec->IsObject()) return false;
+          Local<Value> val = spec->ToObject()->Get(String::NewSymbol("conds"));
+          if (NOU(val)) return true;
+          if (!val->IsArray()) return false;
+          Local<Array> conds = Local<Array>::Cast(val);
+          int num = conds->Length();
+          for (int i = 0; i < num; i++) {
+            val = conds->Get(i);
+            if (!val->IsArray() ||
+                !Local<Array>::Cast(val)->Get(1)->IsNumber()) {
+              return false;
+            }
+          }
+          return true;
+        }
+
+        // the compiled query for the parameters (NULL when there are none)
+        TDBQRY *
+        lookup (const TCLIST *params) {
+          TCXSTR *key = tcxstrnew();
+          int num = params == NULL ? 0 : tclistnum(params);
+          for (int i = 0; i < num; i++) {
+            int vsiz;
+            const void *vbuf = tclistval(params, i, &vsiz);
+            tcxstrcat(key, &vsiz, sizeof(vsiz));
+            tcxstrcat(key, vbuf, vsiz);
+          }
+          TDBQRY *qry;
+          int vsiz;
+          // tcmapget3 moves the record to the tail, which makes the head
+          // the least recently used one
+          const void *vbuf = tcmapget3(cache, tcxstrptr(key),
+                                       tcxstrsize(key), &vsiz);
+          if (vbuf != NULL) {
+            memcpy(&qry, vbuf, sizeof(qry));
+          } else {
+            qry = compile(params);
+            tcmapput(cache, tcxstrptr(key), tcxstrsize(key),
+                     &qry, sizeof(qry));
+            if (tcmaprnum(cache) > (uint64_t)cachemax) {
+              tcmapiterinit(cache);
+              int ksiz;
+              const void *kbuf = tcmapiternext(cache, &ksiz);
+              TDBQRY *old;
+              memcpy(&old, tcmapiterval(kbuf, &vsiz), sizeof(old));
+              tctdbqrydel(old);
+              tcmapout(cache, kbuf, ksiz);
+            }
+          }
+          tcxstrdel(key);
+          return qry;
+        }
+    };
+
+    const static Persistent<FunctionTemplate> Tmpl;
+
+    QRY (TCTDB *db) : prep(NULL), busy(0) {
       qry = tctdbqrynew(db);
     }
 
+    QRY (TCTDB *db, const Handle<Object> spec) : busy(0) {
+      prep = new Prepared(db, spec);
+      // with parameters there is nothing to run until bind (see Bound)
+      qry = prep->pnum > 0 ? NULL : prep->lookup(NULL);
+    }
+
     ~QRY () {
-      tctdbqrydel(qry);
+      // compiled queries of a prepared query belong to its cache
+      if (prep != NULL) {
+        delete prep;
+      } else {
+        tctdbqrydel(qry);
+      }
     }
 
     static QRY *
@@ -3123,79 +5456,162 @@ class QRY : TCWrap {
     static void
     Initialize (const Handle<Object> target) {
       HandleScope scope;
-      Local<FunctionTemplate> tmpl = FunctionTemplate::New(New);
-      set_ecodes(tmpl);
+      set_ecodes(Tmpl);
 
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCSTREQ);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCSTRINC);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCSTRBW);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCSTREW);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCSTRAND);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCSTROR);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCSTROREQ);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCSTRRX);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCNUMEQ);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCNUMGT);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCNUMGE);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCNUMLT);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCNUMLE);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCNUMBT);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCNUMOREQ);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCFTSPH);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCFTSAND);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCFTSOR);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCFTSEX);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCNEGATE);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QCNOIDX);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QOSTRASC);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QOSTRDESC);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QONUMASC);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QONUMDESC);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QPPUT);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QPOUT);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, QPSTOP);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, MSUNION);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, MSISECT);
-      DEFINE_PREFIXED_CONSTANT(tmpl, TDB, MSDIFF);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCSTREQ);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCSTRINC);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCSTRBW);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCSTREW);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCSTRAND);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCSTROR);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCSTROREQ);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCSTRRX);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCNUMEQ);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCNUMGT);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCNUMGE);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCNUMLT);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCNUMLE);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCNUMBT);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCNUMOREQ);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCFTSPH);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCFTSAND);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCFTSOR);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCFTSEX);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCNEGATE);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QCNOIDX);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QOSTRASC);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QOSTRDESC);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QONUMASC);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QONUMDESC);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QPPUT);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QPOUT);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, QPSTOP);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, MSUNION);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, MSISECT);
+      DEFINE_PREFIXED_CONSTANT(Tmpl, TDB, MSDIFF);
       
-      NODE_SET_PROTOTYPE_METHOD(tmpl, "addcond", Addcond);
-      NODE_SET_PROTOTYPE_METHOD(tmpl, "setorder", Setorder);
-      NODE_SET_PROTOTYPE_METHOD(tmpl, "setlimit", Setlimit);
-      NODE_SET_PROTOTYPE_METHOD(tmpl, "search", SearchSync);
-      NODE_SET_PROTOTYPE_METHOD(tmpl, "searchAsync", SearchAsync);
-      NODE_SET_PROTOTYPE_METHOD(tmpl, "searchout", SearchoutSync);
-      NODE_SET_PROTOTYPE_METHOD(tmpl, "searchoutAsync", SearchoutAsync);
-      NODE_SET_PROTOTYPE_METHOD(tmpl, "hint", Hint);
-      NODE_SET_PROTOTYPE_METHOD(tmpl, "metasearch", MetasearchSync);
-      NODE_SET_PROTOTYPE_METHOD(tmpl, "metasearchAsync", MetasearchAsync);
-
-      Local<ObjectTemplate> ot = tmpl->InstanceTemplate();
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "addcond", Addcond);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setorder", Setorder);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setlimit", Setlimit);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "search", SearchSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "searchAsync", SearchAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "count", CountSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "countAsync", CountAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "searchGet", SearchGetSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "searchGetAsync", SearchGetAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "aggregate", AggregateSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "aggregateAsync", AggregateAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "searchout", SearchoutSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "searchoutAsync", SearchoutAsync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "hint", Hint);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "setpacked", SetpackedSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "latencyStats", LatencyStatsSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "bind", Bind);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "metasearch", MetasearchSync);
+      NODE_SET_PROTOTYPE_METHOD(Tmpl, "metasearchAsync", MetasearchAsync);
+
+      Local<ObjectTemplate> ot = Tmpl->InstanceTemplate();
       ot->SetInternalFieldCount(1);
 
-      target->Set(String::New("TDBQRY"), tmpl->GetFunction());
+      target->Set(String::New("TDBQRY"), Tmpl->GetFunction());
     }
 
   private:
     TDBQRY *qry;
+    Prepared *prep;
+    // symbols of the column names of the database (see Colnames)
+    Colnames *names;
+    // async jobs using the query (see Bind)
+    int busy;
+
+    // async data of the methods of a query, which keeps the query from
+    // being rebound until the job is done
+    class QueryAsyncData : public AsyncData {
+      public:
+        QueryAsyncData (Handle<Value> cb_) : AsyncData(cb_) {
+          static_cast<QRY *>(tcw)->busy++;
+        }
+
+        ~QueryAsyncData () {
+          static_cast<QRY *>(tcw)->busy--;
+        }
+    };
+
+    // whether the query has something to run; the methods which run a
+    // prepared query with parameters throw until it is bound
+    static bool
+    Bound (const Handle<Value> obj) {
+      return Backend(obj->ToObject()) != NULL;
+    }
+
+    // thrown when a method would change a query an async method is using
+    static Handle<Value>
+    ThrowInUse () {
+      return ThrowException(Exception::Error(
+            String::New("Query is in use by an async method")));
+    }
 
+    // arg[0] : TDB object
+    // arg[1] : spec of a prepared query (see Prepared)
     static Handle<Value>
     New (const Arguments& args) {
       HandleScope scope;
       if (args.Length() < 1 ||
-          !TDB::Tmpl->HasInstance(args[0])) {
+          !TDB::Tmpl->HasInstance(args[0]) ||
+          !(NOU(args[1]) || Prepared::checkSpec(args[1]))) {
+        return THROW_BAD_ARGS;
+      }
+      TDB *tdb = ObjectWrap::Unwrap<TDB>(Local<Object>::Cast(args[0]));
+      QRY *qry = NOU(args[1]) ? new QRY(tdb->tdb) :
+        new QRY(tdb->tdb, args[1]->ToObject());
+      qry->Inherit(tdb);
+      qry->names = &tdb->names;
+      qry->Wrap(THIS);
+      return THIS;
+    }
+
+    // Bind parameters to a prepared query
+    // arg[0] : Array of parameters, one for each "?" in the conditions
+    //          (Strings, Numbers or Buffers)
+    // returns this query
+    // throws while an async method is using the query, since the compiled
+    // query it runs could be replaced or evicted from the cache under it
+    static Handle<Value>
+    Bind (const Arguments& args) {
+      HandleScope scope;
+      QRY *qry = Unwrap(THIS);
+      if (qry->prep == NULL || !args[0]->IsArray()) {
+        return THROW_BAD_ARGS;
+      }
+      Local<Array> ary = Local<Array>::Cast(args[0]);
+      int num = ary->Length();
+      if (num != qry->prep->pnum) {
         return THROW_BAD_ARGS;
       }
-      TCTDB *db = ObjectWrap::Unwrap<TDB>(Local<Object>::Cast(args[0]))->tdb;
-      (new QRY(db))->Wrap(THIS);
+      // arytotclist skips the other types, which would leave "?" unbound
+      for (int i = 0; i < num; i++) {
+        Local<Value> val = ary->Get(i);
+        if (!(val->IsString() || val->IsNumber() ||
+              Buffer::HasInstance(val))) {
+          return THROW_BAD_ARGS;
+        }
+      }
+      if (qry->busy > 0) return ThrowInUse();
+      TCLIST *params = arytotclist(ary);
+      qry->qry = qry->prep->lookup(params);
+      tclistdel(params);
       return THIS;
     }
 
+    // conditions, order and limit of a prepared query are fixed by its spec
+    // (the compiled queries belong to its cache)
     static Handle<Value>
     Addcond (const Arguments& args) {
       HandleScope scope;
-      if (!args[1]->IsNumber()) {
+      if (Unwrap(THIS)->prep != NULL || !args[1]->IsNumber()) {
         return THROW_BAD_ARGS;
       }
+      if (Unwrap(THIS)->busy > 0) return ThrowInUse();
       tctdbqryaddcond(
           Backend(THIS),
           *String::Utf8Value(args[0]),
@@ -3207,9 +5623,11 @@ class QRY : TCWrap {
     static Handle<Value>
     Setorder (const Arguments& args) {
       HandleScope scope;
-      if (!(args[1]->IsNumber() || NOU(args[1]))) {
+      if (Unwrap(THIS)->prep != NULL ||
+          !(args[1]->IsNumber() || NOU(args[1]))) {
         return THROW_BAD_ARGS;
       }
+      if (Unwrap(THIS)->busy > 0) return ThrowInUse();
       tctdbqrysetorder(
           Backend(THIS),
           *String::Utf8Value(args[0]),
@@ -3220,10 +5638,12 @@ class QRY : TCWrap {
     static Handle<Value>
     Setlimit (const Arguments& args) {
       HandleScope scope;
-      if (!(args[0]->IsNumber() || NOU(args[0])) ||
+      if (Unwrap(THIS)->prep != NULL ||
+          !(args[0]->IsNumber() || NOU(args[0])) ||
           !(args[1]->IsNumber() || NOU(args[1]))) {
         return THROW_BAD_ARGS;
       }
+      if (Unwrap(THIS)->busy > 0) return ThrowInUse();
       tctdbqrysetlimit(
           Backend(THIS),
           NOU(args[1]) ? -1 : args[0]->Int32Value(),
@@ -3246,6 +5666,10 @@ class QRY : TCWrap {
           tclistdel(list);
         }
 
+        static bool checkArgs (const Arguments& args) {
+          return Bound(THIS);
+        }
+
         bool run () {
           list = tcw->Search();
           return true;
@@ -3253,19 +5677,369 @@ class QRY : TCWrap {
 
         Handle<Value> returnValue () {
           HandleScope scope;
-          return scope.Close(tclisttoary(list));
+          return scope.Close(tclisttoval(list, tcw->binary, tcw->packed));
         }
     };
 
     DEFINE_SYNC2(Search)
 
-    class SearchAsyncData : public SearchData, public AsyncData {
+    class SearchAsyncData : public SearchData, public QueryAsyncData {
       public:
         SearchAsyncData (const Arguments& args)
-          : SearchData(args), AsyncData(args[0]), ArgsData(args) {}
+          : SearchData(args), QueryAsyncData(args[0]), ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC2_READ(Search)
+
+    // Number of the matching records, without returning their keys
+    class CountData : public virtual ArgsData {
+      private:
+        int num;
+
+      public:
+        CountData (const Arguments& args) : ArgsData(args) {}
+
+        static bool checkArgs (const Arguments& args) {
+          return Bound(THIS);
+        }
+
+        bool run () {
+          TCLIST *list = tcw->Search();
+          num = tclistnum(list);
+          tclistdel(list);
+          return true;
+        }
+
+        Handle<Value> returnValue () {
+          HandleScope scope;
+          return scope.Close(Integer::New(num));
+        }
+    };
+
+    DEFINE_SYNC2(Count)
+
+    class CountAsyncData : public CountData, public QueryAsyncData {
+      public:
+        CountAsyncData (const Arguments& args)
+          : CountData(args), QueryAsyncData(args[0]), ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC2_READ(Count)
+
+    int Ecode () {
+      return tctdbecode(qry->tdb);
+    }
+
+    TCMAP * Get (char *kbuf, int ksiz) {
+      return tctdbget(qry->tdb, kbuf, ksiz);
+    }
+
+    // Search and fetch the matching records in one call
+    // arg[0] : options ({columns: [...]} to get only these columns)
+    // returns an Array of records, each with the primary key in column ""
+    class SearchGetData : public virtual ArgsData {
+      private:
+        TCLIST *cols;
+        TCPTRLIST *maps;
+
+      public:
+        SearchGetData (const Arguments& args) : ArgsData(args) {
+          cols = optcolumns(args[0]);
+          maps = tcptrlistnew();
+        }
+
+        ~SearchGetData () {
+          if (cols != NULL) tclistdel(cols);
+          for (int i = 0; i < tcptrlistnum(maps); i++) {
+            tcmapdel(static_cast<TCMAP *>(tcptrlistval(maps, i)));
+          }
+          tcptrlistdel(maps);
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          return Bound(THIS) && (NOU(args[0]) || args[0]->IsObject());
+        }
+
+        bool
+        run () {
+          TCLIST *keys = tcw->Search();
+          int num = tclistnum(keys);
+          const char *kbuf;
+          int ksiz;
+          for (int i = 0; i < num; i++) {
+            kbuf = static_cast<const char *>(tclistval(keys, i, &ksiz));
+            TCMAP *map = tcw->Get(const_cast<char *>(kbuf), ksiz);
+            // removed since the search
+            if (map == NULL) continue;
+            if (cols != NULL) map = tcmapproject(map, cols);
+            tcmapput(map, "", 0, kbuf, ksiz);
+            tcptrlistpush(maps, map);
+          }
+          tclistdel(keys);
+          return true;
+        }
+
+        Handle<Value>
+        returnValue () {
+          HandleScope scope;
+          int num = tcptrlistnum(maps);
+          Colnames *names = static_cast<QRY *>(tcw)->names;
+          Local<Array> ary = Array::New(num);
+          for (int i = 0; i < num; i++) {
+            ary->Set(i, tcmaptoobj(
+                  static_cast<TCMAP *>(tcptrlistval(maps, i)), names));
+          }
+          return scope.Close(ary);
+        }
+    };
+
+    DEFINE_SYNC2(SearchGet)
+
+    class SearchGetAsyncData : public SearchGetData, public QueryAsyncData {
+      public:
+        // options may be left out before the callback
+        SearchGetAsyncData (const Arguments& args)
+          : SearchGetData(args),
+            QueryAsyncData(args[0]->IsFunction() ? args[0] : args[1]),
+            ArgsData(args) {}
+    };
+
+    DEFINE_ASYNC2_READ(SearchGet)
+
+    // Fold the matching records into aggregate values
+    // arg[0] : {groupBy: column, ops: {name: [op, column], ...}}
+    //          op is one of 'count', 'sum', 'min', 'max' and 'avg'
+    // returns {name: value, ...}, or {group: {name: value, ...}, ...}
+    // with groupBy (records without the column are grouped in "")
+    class AggregateData : public virtual ArgsData {
+      private:
+        enum { COUNT, SUM, MIN, MAX, AVG };
+
+        struct Acc {
+          double val;
+          int64_t cnt;
+        };
+
+        char *group;
+        int onum;
+        TCLIST *names;
+        char **cols;
+        int *ops;
+        // group value -> index of accumulators in accs
+        TCMAP *groups;
+        TCPTRLIST *accs;
+
+        static int
+        opcode (const Handle<Value> op) {
+          String::Utf8Value name(op);
+          if (strcmp(*name, "count") == 0) return COUNT;
+          if (strcmp(*name, "sum") == 0) return SUM;
+          if (strcmp(*name, "min") == 0) return MIN;
+          if (strcmp(*name, "max") == 0) return MAX;
+          if (strcmp(*name, "avg") == 0) return AVG;
+          return -1;
+        }
+
+        Acc *
+        accumulators (const char *gbuf, int gsiz) {
+          int vsiz;
+          const void *vbuf = tcmapget(groups, gbuf, gsiz, &vsiz);
+          int idx;
+          if (vbuf != NULL) {
+            memcpy(&idx, vbuf, sizeof(idx));
+            return static_cast<Acc *>(tcptrlistval(accs, idx));
+          }
+          idx = tcptrlistnum(accs);
+          tcmapput(groups, gbuf, gsiz, &idx, sizeof(idx));
+          Acc *acc = static_cast<Acc *>(tcmalloc(sizeof(*acc) * (onum + 1)));
+          memset(acc, 0, sizeof(*acc) * (onum + 1));
+          tcptrlistpush(accs, acc);
+          return acc;
+        }
+
+        void
+        fold (Acc *acc, TCMAP *cols_) {
+          for (int i = 0; i < onum; i++) {
+            if (ops[i] == COUNT && cols[i] == NULL) {
+              acc[i].cnt++;
+              continue;
+            }
+            const char *vstr = tcmapget2(cols_, cols[i]);
+            if (vstr == NULL) continue;
+            double num = tcatof(vstr);
+            switch (ops[i]) {
+              case SUM:
+              case AVG:
+                acc[i].val += num;
+                break;
+              case MIN:
+                if (acc[i].cnt == 0 || num < acc[i].val) acc[i].val = num;
+                break;
+              case MAX:
+                if (acc[i].cnt == 0 || num > acc[i].val) acc[i].val = num;
+                break;
+            }
+            acc[i].cnt++;
+          }
+        }
+
+        Local<Object>
+        accstoobj (Acc *acc) {
+          HandleScope scope;
+          Local<Object> obj = Object::New();
+          int nsiz;
+          for (int i = 0; i < onum; i++) {
+            const char *nbuf =
+              static_cast<const char *>(tclistval(names, i, &nsiz));
+            Handle<Value> val;
+            if (ops[i] == COUNT) {
+              val = Number::New(acc[i].cnt);
+            } else if (acc[i].cnt == 0) {
+              val = Null();
+            } else if (ops[i] == AVG) {
+              val = Number::New(acc[i].val / acc[i].cnt);
+            } else {
+              val = Number::New(acc[i].val);
+            }
+            obj->Set(String::New(nbuf, nsiz), val);
+          }
+          return scope.Close(obj);
+        }
+
+      public:
+        AggregateData (const Arguments& args) : ArgsData(args) {
+          HandleScope scope;
+          Local<Object> spec = args[0]->ToObject();
+          Local<Value> gval = spec->Get(String::NewSymbol("groupBy"));
+          group = NOU(gval) ? NULL : tcstrdup(*String::Utf8Value(gval));
+          Local<Object> oops =
+            spec->Get(String::NewSymbol("ops"))->ToObject();
+          Local<Array> keys = oops->GetPropertyNames();
+          onum = keys->Length();
+          names = tclistnew2(onum);
+          cols = static_cast<char **>(tcmalloc(sizeof(*cols) * (onum + 1)));
+          ops = static_cast<int *>(tcmalloc(sizeof(*ops) * (onum + 1)));
+          for (int i = 0; i < onum; i++) {
+            Local<Value> key = keys->Get(i);
+            String::Utf8Value name(key);
+            tclistpush(names, *name, name.length());
+            Local<Value> op = oops->Get(key);
+            if (op->IsArray()) {
+              Local<Array> pair = Local<Array>::Cast(op);
+              ops[i] = opcode(pair->Get(0));
+              Local<Value> col = pair->Get(1);
+              cols[i] = NOU(col) ? NULL : tcstrdup(*String::Utf8Value(col));
+            } else {
+              ops[i] = opcode(op);
+              cols[i] = NULL;
+            }
+          }
+          groups = tcmapnew();
+          accs = tcptrlistnew();
+        }
+
+        ~AggregateData () {
+          if (group != NULL) tcfree(group);
+          for (int i = 0; i < onum; i++) {
+            if (cols[i] != NULL) tcfree(cols[i]);
+          }
+          tcfree(cols);
+          tcfree(ops);
+          tclistdel(names);
+          tcmapdel(groups);
+          for (int i = 0; i < tcptrlistnum(accs); i++) {
+            tcfree(tcptrlistval(accs, i));
+          }
+          tcptrlistdel(accs);
+        }
+
+        static bool
+        checkArgs (const Arguments& args) {
+          HandleScope scope;
+          if (!Bound(THIS) || !args[0]->IsObject()) return false;
+          Local<Value> oops =
+            args[0]->ToObject()->Get(String::NewSymbol("ops"));
+          if (!oops->IsObject()) return false;
+          Local<Array> keys = oops->ToObject()->GetPropertyNames();
+          int num = keys->Length();
+          for (int i = 0; i < num; i++) {
+            Local<Value> op =
+              oops->ToObject()->Get(keys->Get(i));
+            Local<Value> col;
+            if (op->IsArray()) {
+              Local<Array> pair = Local<Array>::Cast(op);
+              op = pair->Get(0);
+              col = pair->Get(1);
+            }
+            int code = opcode(op);
+            // only count can go without a column
+            if (code < 0 ||
+                (code != COUNT && (col.IsEmpty() || !col->IsString()))) {
+              return false;
+            }
+          }
+          return true;
+        }
+
+        bool
+        run () {
+          // without groupBy there is one group even if nothing matches
+          if (group == NULL) accumulators("", 0);
+          TCLIST *keys = tcw->Search();
+          int num = tclistnum(keys);
+          int ksiz;
+          for (int i = 0; i < num; i++) {
+            char *kbuf = static_cast<char *>(
+                const_cast<void *>(tclistval(keys, i, &ksiz)));
+            TCMAP *map = tcw->Get(kbuf, ksiz);
+            if (map == NULL) continue;
+            // the size from the map, as values may contain NUL
+            int gsiz = 0;
+            const char *gbuf = group == NULL ? NULL :
+              static_cast<const char *>(
+                  tcmapget(map, group, strlen(group), &gsiz));
+            if (gbuf == NULL) {
+              gbuf = "";
+              gsiz = 0;
+            }
+            fold(accumulators(gbuf, gsiz), map);
+            tcmapdel(map);
+          }
+          tclistdel(keys);
+          return true;
+        }
+
+        Handle<Value>
+        returnValue () {
+          HandleScope scope;
+          if (group == NULL) {
+            return scope.Close(
+                accstoobj(static_cast<Acc *>(tcptrlistval(accs, 0))));
+          }
+          Local<Object> obj = Object::New();
+          const char *gbuf;
+          int gsiz, idx, vsiz;
+          tcmapiterinit(groups);
+          while ((gbuf = static_cast<const char *>(
+                      tcmapiternext(groups, &gsiz))) != NULL) {
+            memcpy(&idx, tcmapiterval(gbuf, &vsiz), sizeof(idx));
+            obj->Set(String::New(gbuf, gsiz),
+                accstoobj(static_cast<Acc *>(tcptrlistval(accs, idx))));
+          }
+          return scope.Close(obj);
+        }
+    };
+
+    DEFINE_SYNC2(Aggregate)
+
+    class AggregateAsyncData : public AggregateData, public QueryAsyncData {
+      public:
+        AggregateAsyncData (const Arguments& args)
+          : AggregateData(args), QueryAsyncData(args[1]), ArgsData(args) {}
     };
 
-    DEFINE_ASYNC2(Search)
+    DEFINE_ASYNC2_READ(Aggregate)
 
     bool Searchout () {
       return tctdbqrysearchout(qry);
@@ -3275,6 +6049,10 @@ class QRY : TCWrap {
       public:
         SearchoutData (const Arguments& args) : ArgsData(args) {}
 
+        static bool checkArgs (const Arguments& args) {
+          return Bound(THIS);
+        }
+
         bool run () {
           return tcw->Searchout();
         }
@@ -3282,10 +6060,10 @@ class QRY : TCWrap {
 
     DEFINE_SYNC(Searchout)
 
-    class SearchoutAsyncData : public SearchoutData, public AsyncData {
+    class SearchoutAsyncData : public SearchoutData, public QueryAsyncData {
       public:
         SearchoutAsyncData (const Arguments& args)
-          : SearchoutData(args), AsyncData(args[0]), ArgsData(args) {}
+          : SearchoutData(args), QueryAsyncData(args[0]), ArgsData(args) {}
     };
 
     DEFINE_ASYNC(Searchout)
@@ -3293,6 +6071,7 @@ class QRY : TCWrap {
     static Handle<Value>
     Hint (const Arguments& args) {
       HandleScope scope;
+      if (!Bound(THIS)) return THROW_BAD_ARGS;
       const char *hint = tctdbqryhint(Backend(THIS));
       return String::New(hint);
     }
@@ -3304,21 +6083,26 @@ class QRY : TCWrap {
     class MetasearchData : public virtual ArgsData {
       private:
         TDBQRY **qrys;
+        // the other queries, kept from being rebound (see Bind)
+        QRY **others;
         int qnum;
         int type;
         TCLIST *list;
 
       public:
         MetasearchData (const Arguments& args) : ArgsData(args) {
-          Local<Array> others = Local<Array>::Cast(args[0]);
-          int num = others->Length();
+          Local<Array> ary = Local<Array>::Cast(args[0]);
+          int num = ary->Length();
           qrys = static_cast<TDBQRY **>(tcmalloc(sizeof(*qrys) * (num+1)));
+          others = static_cast<QRY **>(tcmalloc(sizeof(*others) * (num+1)));
           qnum = 0;
           qrys[qnum++] = Backend(THIS);
           Local<Object> oqry;
           for (int i = 0; i < num; i++) {
-            oqry = others->CloneElementAt(i);
-            if (TDB::Tmpl->HasInstance(oqry)) {
+            oqry = ary->CloneElementAt(i);
+            if (Tmpl->HasInstance(oqry)) {
+              others[qnum - 1] = Unwrap(oqry);
+              others[qnum - 1]->busy++;
               qrys[qnum++] = Backend(oqry);
             }
           }
@@ -3326,6 +6110,10 @@ class QRY : TCWrap {
         }
 
         ~MetasearchData () {
+          for (int i = 0; i < qnum - 1; i++) {
+            others[i]->busy--;
+          }
+          tcfree(others);
           tcfree(qrys);
           tclistdel(list);
         }
@@ -3336,27 +6124,317 @@ class QRY : TCWrap {
         }
 
         static bool checkArgs (const Arguments& args) {
-          return args[0]->IsArray() &&
-                 (args[1]->IsNumber() || NOU(args[1]));
+          HandleScope scope;
+          if (!Bound(THIS) || !args[0]->IsArray() ||
+              !(args[1]->IsNumber() || NOU(args[1]))) {
+            return false;
+          }
+          Local<Array> ary = Local<Array>::Cast(args[0]);
+          int num = ary->Length();
+          for (int i = 0; i < num; i++) {
+            Local<Value> oqry = ary->Get(i);
+            if (Tmpl->HasInstance(oqry) && !Bound(oqry)) return false;
+          }
+          return true;
         }
 
         Handle<Value> returnValue () {
           HandleScope scope;
-          return scope.Close(tclisttoary(list));
+          return scope.Close(tclisttoval(list, tcw->binary, tcw->packed));
         }
     };
 
     DEFINE_SYNC2(Metasearch)
 
-    class MetasearchAsyncData : public MetasearchData, public AsyncData {
+    class MetasearchAsyncData : public MetasearchData, public QueryAsyncData {
       public:
         MetasearchAsyncData (const Arguments& args)
-          : MetasearchData(args), AsyncData(args[2]), ArgsData(args) {}
+          : MetasearchData(args), QueryAsyncData(args[2]), ArgsData(args) {}
     };
 
-    DEFINE_ASYNC2(Metasearch)
+    DEFINE_ASYNC2_READ(Metasearch)
+
+    // a record found by a query of metasearchParallel
+    struct Hit {
+      const char *kbuf;
+      int ksiz;
+      const char *obuf;
+      int osiz;
+      double onum;
+    };
+
+    class Parallel;
+
+    // search of one query of metasearchParallel, run in its own job
+    class Shard {
+      public:
+        Parallel *all;
+        QRY *qry;
+        TCLIST *keys;
+        // values of the order column
+        TCLIST *ovals;
+        Hit *hits;
+        int hnum;
+        int ecode;
+
+        Shard () : keys(NULL), ovals(NULL), hits(NULL), hnum(0),
+                   ecode(TCESUCCESS) {}
+
+        ~Shard () {
+          if (keys != NULL) tclistdel(keys);
+          if (ovals != NULL) tclistdel(ovals);
+          if (hits != NULL) tcfree(hits);
+        }
+
+        void run ();
+    };
+
+    // state shared by the jobs of metasearchParallel
+    class Parallel {
+      public:
+        Persistent<Array> qrys;
+        Persistent<Function> cb;
+        char *ocol;
+        int otype;
+        int limit;
+        Shard *shards;
+        int snum;
+        int pending;
+
+        ~Parallel () {
+          if (ocol != NULL) tcfree(ocol);
+          delete [] shards;
+          qrys.Dispose();
+          cb.Dispose();
+        }
+
+        // compares hits in the order of the result
+        int
+        compare (const Hit *a, const Hit *b) {
+          switch (otype) {
+            case TDBQOSTRDESC:
+              return -bytecmp(a, b);
+            case TDBQONUMASC:
+              return a->onum < b->onum ? -1 : a->onum > b->onum;
+            case TDBQONUMDESC:
+              return a->onum > b->onum ? -1 : a->onum < b->onum;
+            default:
+              return bytecmp(a, b);
+          }
+        }
+
+        static int
+        bytecmp (const Hit *a, const Hit *b) {
+          int rv = memcmp(a->obuf, b->obuf,
+                          a->osiz < b->osiz ? a->osiz : b->osiz);
+          return rv != 0 ? rv : a->osiz - b->osiz;
+        }
+
+        // k-way merge of the sorted hits of the shards
+        Handle<Value>
+        merge () {
+          HandleScope scope;
+          int *pos = static_cast<int *>(tccalloc(snum, sizeof(*pos)));
+          TCLIST *keys = tclistnew();
+          Local<Array> idxs = Array::New();
+          int num = 0;
+          while (limit < 0 || num < limit) {
+            int best = -1;
+            for (int i = 0; i < snum; i++) {
+              if (pos[i] >= shards[i].hnum) continue;
+              if (best < 0 || (ocol != NULL &&
+                  compare(shards[i].hits + pos[i],
+                          shards[best].hits + pos[best]) < 0)) {
+                best = i;
+              }
+            }
+            if (best < 0) break;
+            Hit *hit = shards[best].hits + pos[best]++;
+            tclistpush(keys, hit->kbuf, hit->ksiz);
+            idxs->Set(num++, Integer::New(best));
+          }
+          Local<Array> ary = Array::New(2);
+          ary->Set(0, tclisttoary(keys));
+          ary->Set(1, idxs);
+          tclistdel(keys);
+          tcfree(pos);
+          return scope.Close(ary);
+        }
+    };
+
+    static int
+    ExecShard (eio_req *req) {
+      static_cast<Shard *>(req->data)->run();
+      return 0;
+    }
+
+    static int
+    AfterShard (eio_req *req) {
+      HandleScope scope;
+      Shard *shard = static_cast<Shard *>(req->data);
+      Parallel *all = shard->all;
+      shard->qry->busy--;
+      ev_unref(EV_DEFAULT_UC);
+      if (--all->pending > 0) return 0;
+      // the error of the first shard which failed, whose records are
+      // missing from the result
+      int ecode = TCESUCCESS;
+      for (int i = 0; i < all->snum && ecode == TCESUCCESS; i++) {
+        ecode = all->shards[i].ecode;
+      }
+      Handle<Value> argv[2] = {Integer::New(ecode), all->merge()};
+      TryCatch try_catch;
+      all->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+      if (try_catch.HasCaught()) {
+        FatalException(try_catch);
+      }
+      delete all;
+      return 0;
+    }
+
+  public:
+    // Search with the queries in parallel, one job for each query, and
+    // merge the results
+    // arg[0] : Array of queries (usually of different databases)
+    // arg[1] : options {order: [column, type], limit: max}, which are set
+    //          on every query during its search so that each returns at
+    //          most max sorted keys (may be left out before the callback)
+    // arg[2] : callback, called with [keys, indexes of the queries]
+    // throws while an async method is using one of the queries
+    static Handle<Value>
+    MetasearchParallel (const Arguments& args) {
+      HandleScope scope;
+      Handle<Value> cb = args[1]->IsFunction() ? args[1] : args[2];
+      Handle<Value> opts = args[1]->IsFunction() ?
+        Handle<Value>(Undefined()) : args[1];
+      if (!args[0]->IsArray() || !cb->IsFunction() ||
+          !(NOU(opts) || opts->IsObject())) {
+        return THROW_BAD_ARGS;
+      }
+      Local<Array> qrys = Local<Array>::Cast(args[0]);
+      int num = qrys->Length();
+      if (num == 0) return THROW_BAD_ARGS;
+      for (int i = 0; i < num; i++) {
+        Local<Value> qobj = qrys->Get(i);
+        if (!Tmpl->HasInstance(qobj) || !Bound(qobj)) return THROW_BAD_ARGS;
+        // a query is searched by one shard only (see Shard::run)
+        for (int j = 0; j < i; j++) {
+          if (qrys->Get(j)->StrictEquals(qobj)) return THROW_BAD_ARGS;
+        }
+        if (Unwrap(qobj->ToObject())->busy > 0) return ThrowInUse();
+      }
+      Parallel *all = new Parallel;
+      all->qrys = Persistent<Array>::New(qrys);
+      all->cb = Persistent<Function>::New(Local<Function>::Cast(cb));
+      all->ocol = NULL;
+      all->otype = TDBQOSTRASC;
+      all->limit = -1;
+      if (opts->IsObject()) {
+        Local<Value> val = opts->ToObject()->Get(String::NewSymbol("order"));
+        if (val->IsArray()) {
+          Local<Array> order = Local<Array>::Cast(val);
+          all->ocol =
+            tcstrdup(*String::Utf8Value(order->Get(0)));
+          Local<Value> type = order->Get(1);
+          if (!NOU(type)) all->otype = type->Int32Value();
+        }
+        val = opts->ToObject()->Get(String::NewSymbol("limit"));
+        if (val->IsNumber()) all->limit = val->Int32Value();
+      }
+      all->snum = num;
+      all->pending = num;
+      all->shards = new Shard[num];
+      for (int i = 0; i < num; i++) {
+        Local<Object> qobj = qrys->Get(i)->ToObject();
+        Shard *shard = all->shards + i;
+        shard->all = all;
+        shard->qry = Unwrap(qobj);
+        shard->qry->busy++;
+        Submit(qobj, ExecShard, AfterShard, shard, true);
+        ev_ref(EV_DEFAULT_UC);
+      }
+      return Undefined();
+    }
 };
 
+// runs in a worker thread
+// The order and limit are set on the query for this search only and then
+// put back, so the query of the caller is left as it was. The query is busy
+// meanwhile, so nothing else changes it. Only the values of the order column
+// of the sorted and limited hits are fetched for the merge.
+void
+QRY::Shard::run () {
+  TDBQRY *tq = qry->qry;
+  TCTDB *tdb = tq->tdb;
+  char *oname = tq->oname == NULL ? NULL : tcstrdup(tq->oname);
+  int otype = tq->otype;
+  int max = tq->max;
+  int skip = tq->skip;
+  if (all->ocol != NULL) tctdbqrysetorder(tq, all->ocol, all->otype);
+  if (all->limit >= 0) tctdbqrysetlimit(tq, all->limit, 0);
+  // the error code is kept per thread with a mutex; it is cleared to tell
+  // an error of this search from earlier ones
+  tctdbsetecode(tdb, TCESUCCESS, __FILE__, __LINE__, __func__);
+  keys = qry->Search();
+  ecode = tctdbecode(tdb);
+  if (oname != NULL) {
+    tctdbqrysetorder(tq, oname, otype);
+    tcfree(oname);
+  } else if (tq->oname != NULL) {
+    // there is no API to unset the order
+    tcfree(tq->oname);
+    tq->oname = NULL;
+    tq->otype = otype;
+  }
+  tctdbqrysetlimit(tq, max, skip);
+  // records removed while the search ran are left out without an error
+  if (ecode == TCENOREC) ecode = TCESUCCESS;
+  hnum = tclistnum(keys);
+  hits = static_cast<Hit *>(tcmalloc(sizeof(*hits) * (hnum + 1)));
+  ovals = tclistnew2(hnum + 1);
+  for (int i = 0; i < hnum; i++) {
+    Hit *hit = hits + i;
+    hit->kbuf = static_cast<const char *>(tclistval(keys, i, &hit->ksiz));
+    if (all->ocol == NULL) continue;
+    TCMAP *map = qry->Get(const_cast<char *>(hit->kbuf), hit->ksiz);
+    const char *obuf = NULL;
+    int osiz = 0;
+    if (map != NULL) {
+      obuf = static_cast<const char *>(
+          tcmapget(map, all->ocol, strlen(all->ocol), &osiz));
+    }
+    if (obuf == NULL) {
+      obuf = "";
+      osiz = 0;
+    }
+    tclistpush(ovals, obuf, osiz);
+    if (map != NULL) tcmapdel(map);
+  }
+  if (all->ocol == NULL) return;
+  for (int i = 0; i < hnum; i++) {
+    hits[i].obuf =
+      static_cast<const char *>(tclistval(ovals, i, &hits[i].osiz));
+    hits[i].onum = tcatof(hits[i].obuf);
+  }
+}
+
+// TDB.metasearchParallel(qrys, opts, cb)
+Handle<Value>
+TDB::MetasearchParallel (const Arguments& args) {
+  return QRY::MetasearchParallel(args);
+}
+
+const Persistent<FunctionTemplate> QRY::Tmpl =
+  Persistent<FunctionTemplate>::New(FunctionTemplate::New(QRY::New));
+
+// tdb.prepare(spec) is a shorthand of new TDBQRY(tdb, spec)
+Handle<Value>
+TDB::Prepare (const Arguments& args) {
+  HandleScope scope;
+  Handle<Value> argv[2] = {THIS, args[0]};
+  return scope.Close(QRY::Tmpl->GetFunction()->NewInstance(2, argv));
+}
+
 class ADB : TCWrap {
   public:
     ADB () {
@@ -3374,6 +6452,11 @@ class ADB : TCWrap {
       set_ecodes(tmpl);
       tmpl->InstanceTemplate()->SetInternalFieldCount(1);
 
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setbinary", SetbinarySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setpacked", SetpackedSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setexternal", SetexternalSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "setcoalesce", SetcoalesceSync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "latencyStats", LatencyStatsSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "open", OpenSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "openAsync", OpenAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "close", CloseSync);
@@ -3386,14 +6469,22 @@ class ADB : TCWrap {
       NODE_SET_PROTOTYPE_METHOD(tmpl, "putcatAsync", PutcatAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "out", OutSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "outAsync", OutAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "putmany", PutmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "putmanyAsync", PutmanyAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "outmany", OutmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "outmanyAsync", OutmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "get", GetSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "getAsync", GetAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "getmany", GetmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "getmanyAsync", GetmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "vsiz", VsizSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "vsizAsync", VsizAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iterinit", IterinitSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iterinitAsync", IterinitAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iternext", IternextSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "iternextAsync", IternextAsync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "iternextmany", IternextmanySync);
+      NODE_SET_PROTOTYPE_METHOD(tmpl, "iternextmanyAsync", IternextmanyAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "fwmkeys", FwmkeysSync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "fwmkeysAsync", FwmkeysAsync);
       NODE_SET_PROTOTYPE_METHOD(tmpl, "addint", AddintSync);
@@ -3473,7 +6564,7 @@ class ADB : TCWrap {
     }
 
     DEFINE_SYNC(Put)
-    DEFINE_ASYNC(Put)
+    DEFINE_ASYNC_QUEUED(Put)
 
     bool Putkeep(char *kbuf, int ksiz, char *vbuf, int vsiz) {
       return tcadbputkeep(adb, kbuf, ksiz, vbuf, vsiz);
@@ -3494,21 +6585,27 @@ class ADB : TCWrap {
     }
 
     DEFINE_SYNC(Out)
-    DEFINE_ASYNC(Out)
+    DEFINE_ASYNC_QUEUED(Out)
+    DEFINE_SYNC(Putmany)
+    DEFINE_ASYNC(Putmany)
+    DEFINE_SYNC(Outmany)
+    DEFINE_ASYNC(Outmany)
 
     char * Get(char *kbuf, int ksiz, int *vsiz_p) {
       return static_cast<char *>(tcadbget(adb, kbuf, ksiz, vsiz_p));
     }
 
     DEFINE_SYNC2(Get)
-    DEFINE_ASYNC2(Get)
+    DEFINE_ASYNC2_READ(Get)
+    DEFINE_SYNC2(Getmany)
+    DEFINE_ASYNC2_READ(Getmany)
 
     int Vsiz(char *kbuf, int ksiz) {
       return tcadbvsiz(adb, kbuf, ksiz);
     }
 
     DEFINE_SYNC2(Vsiz)
-    DEFINE_ASYNC2(Vsiz)
+    DEFINE_ASYNC2_READ(Vsiz)
 
     bool Iterinit () {
       return tcadbiterinit(adb);
@@ -3523,20 +6620,22 @@ class ADB : TCWrap {
 
     DEFINE_SYNC2(Iternext)
     DEFINE_ASYNC2(Iternext)
+    DEFINE_SYNC2(Iternextmany)
+    DEFINE_ASYNC2(Iternextmany)
 
     TCLIST * Fwmkeys(char *kbuf, int ksiz, int max) {
       return tcadbfwmkeys(adb, kbuf, ksiz, max);
     }
 
     DEFINE_SYNC2(Fwmkeys)
-    DEFINE_ASYNC2(Fwmkeys)
+    DEFINE_ASYNC2_READ(Fwmkeys)
 
     int Addint(char *kbuf, int ksiz, int num) {
       return tcadbaddint(adb, kbuf, ksiz, num);
     }
 
     DEFINE_SYNC2(Addint)
-    DEFINE_ASYNC2(Addint)
+    DEFINE_ASYNC2_QUEUED(Addint)
 
     double Adddouble(char *kbuf, int ksiz, double num) {
       return tcadbadddouble(adb, kbuf, ksiz, num);
@@ -3680,7 +6779,7 @@ class ADB : TCWrap {
         Handle<Value> returnValue () {
           HandleScope scope;
           return scope.Close(ret == NULL ? Handle<Value>(Null()) : 
-                                           tclisttoary(ret));
+                                           tclisttoary(ret, tcw->binary));
         }
     };
 
@@ -3694,16 +6793,32 @@ class ADB : TCWrap {
     DEFINE_ASYNC2(Misc)
 };
 
+// Size of the eio thread pool, which runs the async methods of all
+// databases (except with setserial) and the fs module of node alike.
+static Handle<Value>
+Setthreads (const Arguments& args) {
+  HandleScope scope;
+  if (!args[0]->IsNumber() || args[0]->Int32Value() < 1) {
+    return THROW_BAD_ARGS;
+  }
+  unsigned int num = args[0]->Uint32Value();
+  eio_set_min_parallel(num);
+  eio_set_max_parallel(num);
+  return Undefined();
+}
+
 extern "C" void
 init (Handle<Object> target) {
   HandleScope scope;
   HDB::Initialize(target);
   BDB::Initialize(target);
   CUR::Initialize(target);
+  STM::Initialize(target);
   FDB::Initialize(target);
   TDB::Initialize(target);
   QRY::Initialize(target);
   ADB::Initialize(target);
   target->Set(String::NewSymbol("VERSION"), String::New(tcversion));
+  NODE_SET_METHOD(target, "setthreads", Setthreads);
 }
 
@@ -103,11 +103,32 @@ samples.push(function() {
 
                 } else { // if next key does not exist
 
-                  bdb.closeAsync(function(e) {
-                    if (e) sys.error(bdb.errmsg(e));
-                    fs.unlink('casket.tcb');
-
-                    next_sample();
+                  // a batch of no records is a bad argument
+                  try {
+                    cur.read(0);
+                    sys.error('read(0) accepted');
+                  } catch (e) {}
+
+                  // the same in batches of two records
+                  cur.firstAsync(function(e) {
+                    cur.readAsync(2, false, function func2(e, recs) {
+                      if (e !== BDB.ENOREC) {
+                        if (e) sys.error(bdb.errmsg(e));
+                        for (var i = 0; i < recs[0].length; i++) {
+                          sys.puts(recs[0][i] + ':' + recs[1][i]);
+                        }
+                        cur.readAsync(2, false, func2);
+                      } else {
+
+                        bdb.closeAsync(function(e) {
+                          if (e) sys.error(bdb.errmsg(e));
+                          fs.unlink('casket.tcb');
+
+                          next_sample();
+                        });
+
+                      }
+                    });
                   });
 
                 }
@@ -217,11 +238,19 @@ samples.push(function() {
                 }
 
                 if (--n === 0) {
-                  tdb.closeAsync(function(e) {
+                  // options can be left out before the callback
+                  qry.searchGetAsync(function(e, recs) {
                     if (e) sys.error(tdb.errmsg(e));
-                    fs.unlink('casket.tct');
+                    recs.forEach(function(cols) {
+                      sys.puts(cols[""] + "\t" + cols.name);
+                    });
 
-                    next_sample();
+                    tdb.closeAsync(function(e) {
+                      if (e) sys.error(tdb.errmsg(e));
+                      fs.unlink('casket.tct');
+
+                      next_sample();
+                    });
                   });
                 }
 
@@ -287,3 +316,105 @@ samples.push(function() {
 
 });
 
+
+samples.push(function() {
+  sys.puts("== Sample: HDB chunked iteration ==");
+  var HDB = TC.HDB;
+
+  var hdb = new HDB;
+  if (!hdb.setmutex()) throw hdb.errmsg();
+  if (!hdb.open('casket.tch', HDB.OWRITER | HDB.OCREAT)) throw hdb.errmsg();
+  var recs = [];
+  for (var i = 0; i < 100; i++) recs.push(['key' + i, 'val' + i]);
+
+  var count = 0;
+  var done = function() {
+    sys.puts(count + ' records');
+    hdb.closeAsync(function(e) {
+      if (e) sys.error(hdb.errmsg(e));
+      fs.unlink('casket.tch');
+
+      next_sample();
+    });
+  };
+
+  // prefetch: ask for the next chunk before handling the current one.
+  // fetch returns a function which gives the chunk when it is there.
+  var fetched = 0, consumed = 0, seen = {};
+  var fetch = function() {
+    var seq = fetched++, res = null, waiter = null;
+    hdb.iternextmanyAsync(16, {values: true}, function(e, chunk) {
+      res = [seq, e, chunk];
+      if (waiter) waiter.apply(null, res);
+    });
+    return function(cb) {
+      if (res) return cb.apply(null, res);
+      waiter = cb;
+    };
+  };
+  var consume = function(chunk_p) {
+    chunk_p(function(seq, e, chunk) {
+      if (seq !== consumed++) sys.error('chunk ' + seq + ' out of order');
+      if (e === HDB.ENOREC) return done();
+      if (e) sys.error(hdb.errmsg(e));
+      var next = fetch();
+      var keys = chunk[0], vals = chunk[1];
+      for (var j = 0; j < keys.length; j++) {
+        if (seen[keys[j]]) sys.error(keys[j] + ' twice');
+        if (vals[j] !== 'val' + keys[j].slice(3)) sys.error(keys[j]);
+        seen[keys[j]] = true;
+        count++;
+      }
+      // a slow consumer, so that the next chunk is there before it asks
+      setTimeout(function() { consume(next); }, 5);
+    });
+  };
+
+  // a chunk of no records is a bad argument
+  try {
+    hdb.iternextmany(0);
+    sys.error('iternextmany(0) accepted');
+  } catch (e) {}
+
+  // options can be left out before the callback
+  hdb.putmanyAsync(recs, function(e) {
+    if (e) sys.error(hdb.errmsg(e));
+    if (!hdb.iterinit()) throw hdb.errmsg();
+
+    consume(fetch());
+  });
+});
+
+samples.push(function() {
+  sys.puts("== Sample: BDB range stream ==");
+  var BDB = TC.BDB;
+
+  var bdb = new BDB;
+  if (!bdb.setmutex()) throw bdb.errmsg();
+  if (!bdb.open('casket.tcb', BDB.OWRITER | BDB.OCREAT)) throw bdb.errmsg();
+  for (var i = 0; i < 100; i++) bdb.put('key' + (1000 + i), 'val' + i);
+
+  var stream = bdb.createReadStream({gte: 'key1010', lt: 'key1090',
+                                     reverse: true, limit: 5});
+  stream.on('error', function(e) {
+    sys.error(bdb.errmsg(e));
+  });
+
+  // a slow consumer: pipe pauses the stream until it drains
+  var dest = new (require('events').EventEmitter);
+  dest.writable = true;
+  dest.write = function(rec) {
+    sys.puts(rec.key + ':' + rec.value);
+    setTimeout(function() { dest.emit('drain'); }, 10);
+    return false;
+  };
+  dest.end = function() {
+    bdb.closeAsync(function(e) {
+      if (e) sys.error(bdb.errmsg(e));
+      fs.unlink('casket.tcb');
+
+      next_sample();
+    });
+  };
+  stream.pipe(dest);
+});
@@ -121,3 +121,73 @@ samples.push(function() {
   });
 });
 
+samples.push(function() {
+  sys.puts('async batch');
+
+  var hdb = new TC.HDB;
+  // this line is necessary for an async operation
+  if (!hdb.setmutex()) throw hdb.errmsg();
+
+  hdb.openAsync('casket4.tch', TC.HDB.OWRITER | TC.HDB.OCREAT, function(e) {
+    if (e) sys.error(hdb.errmsg(e));
+
+    var t = Date.now();
+    var batch = 1000;
+    var i = 0;
+    (function func() {
+      var recs = [];
+      for (var j = 0; j < batch; j++, i++) {
+        recs.push(['key' + i, 'val' + i + ' 0123456789']);
+      }
+      hdb.putmanyAsync(recs, {tx: true}, function(e) {
+        if (e) sys.error(hdb.errmsg(e));
+        if (i < put_count) {
+          func();
+        } else {
+          sys.puts(Date.now() - t);
+
+          var keys = [];
+          for (var j = 0; j < 10; j++) keys.push('key' + j);
+          hdb.getmanyAsync(keys, function(e, vals) {
+            if (e) sys.error(hdb.errmsg(e));
+            vals.forEach(function(val) {
+              sys.puts(val);
+            });
+            next_sample();
+          });
+        }
+      });
+    }());
+  });
+});
+
+samples.push(function() {
+  sys.puts('list marshalling');
+
+  var bdb = new TC.BDB;
+  if (!bdb.open('casket5.tcb', TC.BDB.OWRITER | TC.BDB.OCREAT)) {
+    sys.error(bdb.errmsg());
+  }
+  var recs = [];
+  for (var i = 0; i < 10000; i++) {
+    recs.push(['key' + (100000 + i), 'val' + i]);
+  }
+  if (!bdb.putmany(recs, {tx: true})) sys.error(bdb.errmsg());
+
+  // range and fwmkeys return 10k keys through tclisttoary, getmany
+  // takes 10k keys through KeylistData (a ByteValue for each key) and
+  // returns the values through takeval
+  var keys = bdb.range(null, true, null, true, -1);
+  var t = Date.now();
+  for (var i = 0; i < 100; i++) bdb.range(null, true, null, true, -1);
+  sys.puts('range ' + (Date.now() - t));
+  t = Date.now();
+  for (var i = 0; i < 100; i++) bdb.fwmkeys('key', -1);
+  sys.puts('fwmkeys ' + (Date.now() - t));
+  t = Date.now();
+  for (var i = 0; i < 100; i++) bdb.getmany(keys);
+  sys.puts('getmany ' + (Date.now() - t));
+
+  bdb.close();
+  next_sample();
+});
@@ -0,0 +1,463 @@
+// Benchmark suite of all database classes
+//
+//  node test/benchsuite.js [--n=20000] [--sizes=16,256,4096] [--threads=4]
+//                          [--depth=64] [--batch=500] [--dbs=HDB,BDB,...]
+//                          [--json]
+//
+// For each database class, value size and thread pool size, every
+// operation is run sync, async (with 'depth' calls in flight) and batched
+// (putmany, getmany and outmany of 'batch' records, one call at a time).
+// Throughput is given in records per second and latencies (p50, p99,
+// p999) in microseconds per call. With --json one JSON document of all
+// the results is printed at the end instead.
+
+var sys = require('sys');
+var TC = require('../build/default/tokyocabinet');
+var fs = require('fs');
+
+var conf = {
+  n: 20000,
+  sizes: [16, 256, 4096],
+  threads: [4],
+  depth: 64,
+  batch: 500,
+  dbs: ['HDB', 'BDB', 'FDB', 'TDB', 'ADB'],
+  json: false
+};
+
+process.argv.slice(2).forEach(function(arg) {
+  var m = arg.match(/^--(\w+)(?:=(.*))?$/);
+  if (!m || !(m[1] in conf)) throw 'unknown option ' + arg;
+  var def = conf[m[1]];
+  if (typeof def === 'boolean') {
+    conf[m[1]] = true;
+  } else if (Array.isArray(def)) {
+    conf[m[1]] = m[2].split(',').map(function(v) {
+      return typeof def[0] === 'number' ? Number(v) : v;
+    });
+  } else {
+    conf[m[1]] = Number(m[2]);
+  }
+});
+
+// microseconds; Date.now() where process.hrtime is not available
+var clock = process.hrtime ? 'us' : 'ms';
+var now = process.hrtime ? function() {
+  var t = process.hrtime();
+  return t[0] * 1e6 + t[1] / 1e3;
+} : function() {
+  return Date.now() * 1e3;
+};
+
+var log = function(str) {
+  if (!conf.json) sys.puts(str);
+};
+
+// ADB has no error codes (every error is EMISC) nor errmsg
+var fail = function(db, e) {
+  throw db.errmsg ? db.errmsg(e) : 'error ' + e;
+};
+
+var exhausted = function(db, e) {
+  return e === TC.HDB.ENOREC || !db.errmsg;
+};
+
+var results = [];
+
+var percentile = function(lats, p) {
+  return lats.length ?
+    Math.round(lats[Math.min(lats.length - 1, Math.floor(lats.length * p))])
+    : 0;
+};
+
+var report = function(res, lats, recs, elapsed) {
+  lats.sort(function(a, b) { return a - b; });
+  res.records = recs;
+  res.calls = lats.length;
+  res.throughput = Math.round(recs / elapsed * 1e6);
+  res.p50 = percentile(lats, 0.5);
+  res.p99 = percentile(lats, 0.99);
+  res.p999 = percentile(lats, 0.999);
+  results.push(res);
+  log([res.db, res.size, res.threads, res.mode, res.op].join(' ') +
+      ': ' + res.throughput + ' rec/s' +
+      ' p50 ' + res.p50 + ' p99 ' + res.p99 + ' p999 ' + res.p999);
+};
+
+var padkey = function(i) {
+  var s = String(i);
+  while (s.length < 8) s = '0' + s;
+  return 'key' + s;
+};
+
+var value = function(size, i) {
+  var s = 'val' + i + ' ';
+  while (s.length < size) s += s;
+  return s.slice(0, size);
+};
+
+// n calls of op(i), which returns the number of records it handled
+// (or false on failure)
+var runSync = function(res, n, op, done) {
+  var lats = [];
+  var recs = 0;
+  var start = now();
+  for (var i = 0; i < n; i++) {
+    var t = now();
+    var r = op(i);
+    if (r === false) fail(res.handle);
+    lats.push(now() - t);
+    if (r === 0) break;
+    recs += r === true ? 1 : r;
+  }
+  report(res, lats, recs, now() - start);
+  done();
+};
+
+// n calls of op(i, cb) with at most depth in flight, where op calls back
+// cb(err, number of records handled). A call calling back with a falsy
+// count ends the run (used for iteration to the end).
+var runAsync = function(res, n, depth, op, done) {
+  var lats = [];
+  var recs = 0;
+  var issued = 0;
+  var inflight = 0;
+  var ended = false;
+  var start = now();
+  var issue = function() {
+    while (!ended && inflight < depth && issued < n) {
+      (function(i) {
+        var t = now();
+        inflight++;
+        op(i, function(e, r) {
+          inflight--;
+          if (e) fail(res.handle, e);
+          lats.push(now() - t);
+          if (r === 0) {
+            ended = true;
+          } else {
+            recs += r === undefined ? 1 : r;
+          }
+          if (inflight === 0 && (ended || issued === n)) {
+            report(res, lats, recs, now() - start);
+            done();
+          } else {
+            issue();
+          }
+        });
+      }(issued++));
+    }
+  };
+  issue();
+};
+
+// Operations of a database, each with a sync, async and batch variant.
+// The variant is called as (db, n, batch) and returns [calls, op] for
+// runSync or runAsync.
+var kvops = function(key, val) {
+  var keys = function(i, batch) {
+    var ary = [];
+    for (var j = i * batch; j < (i + 1) * batch; j++) ary.push(key(j));
+    return ary;
+  };
+  return {
+    put: {
+      sync: function(db, n) {
+        return [n, function(i) { return db.put(key(i), val(i)); }];
+      },
+      async: function(db, n) {
+        return [n, function(i, cb) { db.putAsync(key(i), val(i), cb); }];
+      },
+      batch: function(db, n, batch) {
+        return [Math.ceil(n / batch), function(i, cb) {
+          var recs = keys(i, batch).map(function(k, j) {
+            return [k, val(i * batch + j)];
+          });
+          db.putmanyAsync(recs, {}, function(e) { cb(e, recs.length); });
+        }];
+      }
+    },
+    get: {
+      sync: function(db, n) {
+        return [n, function(i) { return db.get(key(i)) !== null; }];
+      },
+      async: function(db, n) {
+        return [n, function(i, cb) {
+          db.getAsync(key(i), function(e) { cb(e, 1); });
+        }];
+      },
+      batch: function(db, n, batch) {
+        return [Math.ceil(n / batch), function(i, cb) {
+          db.getmanyAsync(keys(i, batch), function(e, vals) {
+            cb(e, vals && vals.length);
+          });
+        }];
+      }
+    },
+    out: {
+      sync: function(db, n) {
+        return [n, function(i) { return db.out(key(i)); }];
+      },
+      async: function(db, n) {
+        return [n, function(i, cb) { db.outAsync(key(i), cb); }];
+      },
+      batch: function(db, n, batch) {
+        return [Math.ceil(n / batch), function(i, cb) {
+          var ks = keys(i, batch);
+          db.outmanyAsync(ks, function(e) { cb(e, ks.length); });
+        }];
+      }
+    }
+  };
+};
+
+// iteration by iternextmany in chunks of batch records
+var iterop = {
+  sync: function(db, n, batch) {
+    db.iterinit();
+    return [n, function(i) {
+      var chunk = db.iternextmany(batch, {values: true});
+      if (!chunk) return exhausted(db, db.ecode && db.ecode()) ? 0 : false;
+      return chunk[0].length;
+    }];
+  },
+  async: function(db, n, batch) {
+    db.iterinit();
+    // one chunk at a time, as the iterator is shared
+    return [n, function(i, cb) {
+      db.iternextmanyAsync(batch, {values: true}, function(e, chunk) {
+        if (e && exhausted(db, e)) return cb(null, 0);
+        cb(e, chunk && chunk[0].length);
+      });
+    }, 1];
+  }
+};
+
+var targets = {
+  HDB: {
+    open: function(size) {
+      var db = new TC.HDB;
+      if (!db.setmutex()) fail(db);
+      if (!db.open('benchsuite.tch',
+                   TC.HDB.OWRITER | TC.HDB.OCREAT | TC.HDB.OTRUNC)) fail(db);
+      return db;
+    },
+    ops: function(size) {
+      var ops = kvops(padkey, function(i) { return value(size, i); });
+      ops.iterate = iterop;
+      return ops;
+    }
+  },
+
+  BDB: {
+    open: function(size) {
+      var db = new TC.BDB;
+      if (!db.setmutex()) fail(db);
+      if (!db.open('benchsuite.tcb',
+                   TC.BDB.OWRITER | TC.BDB.OCREAT | TC.BDB.OTRUNC)) fail(db);
+      return db;
+    },
+    ops: function(size) {
+      var ops = kvops(padkey, function(i) { return value(size, i); });
+      // key ranges of batch records
+      ops.range = {
+        sync: function(db, n, batch) {
+          return [Math.ceil(n / batch), function(i) {
+            var keys = db.range(padkey(i * batch), true,
+                                padkey((i + 1) * batch), false, -1);
+            return keys && keys.length;
+          }];
+        },
+        async: function(db, n, batch) {
+          return [Math.ceil(n / batch), function(i, cb) {
+            db.rangeAsync(padkey(i * batch), true,
+                          padkey((i + 1) * batch), false, -1,
+                          function(e, keys) { cb(e, keys && keys.length); });
+          }];
+        }
+      };
+      // full cursor scan by read of batch records
+      ops.scan = {
+        sync: function(db, n, batch) {
+          var cur = new TC.BDBCUR(db);
+          cur.first();
+          return [n, function(i) {
+            var recs = cur.read(batch, false);
+            if (!recs) return cur.ecode() === TC.BDB.ENOREC ? 0 : false;
+            return recs[0].length;
+          }];
+        },
+        async: function(db, n, batch) {
+          var cur = new TC.BDBCUR(db);
+          cur.first();
+          return [n, function(i, cb) {
+            cur.readAsync(batch, false, function(e, recs) {
+              if (e === TC.BDB.ENOREC) return cb(null, 0);
+              cb(e, recs && recs[0].length);
+            });
+          }, 1];
+        }
+      };
+      return ops;
+    }
+  },
+
+  FDB: {
+    open: function(size) {
+      var db = new TC.FDB;
+      if (!db.setmutex()) fail(db);
+      if (!db.tune(size, -1)) fail(db);
+      if (!db.open('benchsuite.tcf',
+                   TC.FDB.OWRITER | TC.FDB.OCREAT | TC.FDB.OTRUNC)) fail(db);
+      return db;
+    },
+    ops: function(size) {
+      var key = function(i) { return String(i + 1); };
+      var ops = kvops(key, function(i) { return value(size, i); });
+      ops.iterate = iterop;
+      ops.range = {
+        sync: function(db, n, batch) {
+          return [Math.ceil(n / batch), function(i) {
+            var keys = db.range('[' + (i * batch + 1) + ',' +
+                                ((i + 1) * batch) + ']', -1);
+            return keys && keys.length;
+          }];
+        },
+        async: function(db, n, batch) {
+          return [Math.ceil(n / batch), function(i, cb) {
+            db.rangeAsync('[' + (i * batch + 1) + ',' +
+                          ((i + 1) * batch) + ']', -1,
+                          function(e, keys) { cb(e, keys && keys.length); });
+          }];
+        }
+      };
+      return ops;
+    }
+  },
+
+  TDB: {
+    open: function(size) {
+      var db = new TC.TDB;
+      if (!db.setmutex()) fail(db);
+      if (!db.open('benchsuite.tct',
+                   TC.TDB.OWRITER | TC.TDB.OCREAT | TC.TDB.OTRUNC)) fail(db);
+      // the same values in an indexed and an unindexed column
+      if (!db.setindex('idx', TC.TDB.ITDECIMAL)) fail(db);
+      return db;
+    },
+    ops: function(size) {
+      var ops = kvops(padkey, function(i) {
+        return {idx: String(i % 1000), raw: String(i % 1000),
+                data: value(size, i)};
+      });
+      var query = function(col) {
+        var qry = function(db, i) {
+          var q = new TC.TDBQRY(db);
+          q.addcond(col, TC.TDBQRY.QCNUMEQ, String(i % 1000));
+          return q;
+        };
+        return {
+          sync: function(db, n) {
+            return [100, function(i) {
+              var keys = qry(db, i).search();
+              return keys ? keys.length : false;
+            }];
+          },
+          async: function(db, n) {
+            return [100, function(i, cb) {
+              qry(db, i).searchAsync(function(e, keys) {
+                cb(e, keys && keys.length);
+              });
+            }];
+          }
+        };
+      };
+      ops.iterate = iterop;
+      ops.indexed = query('idx');
+      ops.unindexed = query('raw');
+      return ops;
+    }
+  },
+
+  ADB: {
+    // no setmutex, so async calls go one at a time
+    depth: 1,
+    open: function(size) {
+      var db = new TC.ADB;
+      if (!db.open('benchsuite.tch#mode=wct')) fail(db);
+      return db;
+    },
+    ops: function(size) {
+      var ops = kvops(padkey, function(i) { return value(size, i); });
+      ops.iterate = iterop;
+      return ops;
+    }
+  }
+};
+
+// records are put first and removed last by each mode
+var order = ['put', 'get', 'iterate', 'range', 'scan', 'indexed',
+             'unindexed', 'out'];
+
+var cleanup = function() {
+  fs.readdirSync('.').forEach(function(file) {
+    if (file.indexOf('benchsuite.tc') === 0) fs.unlinkSync(file);
+  });
+};
+
+var runs = [];
+conf.dbs.forEach(function(name) {
+  conf.sizes.forEach(function(size) {
+    conf.threads.forEach(function(threads) {
+      ['sync', 'async', 'batch'].forEach(function(mode) {
+        runs.push({db: name, size: size, threads: threads, mode: mode});
+      });
+    });
+  });
+});
+
+var next_run = function() {
+  var run = runs.shift();
+  if (!run) {
+    cleanup();
+    if (conf.json) {
+      sys.puts(JSON.stringify({version: TC.VERSION, clock: clock,
+                               conf: conf, results: results}));
+    }
+    return;
+  }
+  TC.setthreads(run.threads);
+  var target = targets[run.db];
+  var db = target.open(run.size);
+  var ops = target.ops(run.size);
+  var names = order.filter(function(op) {
+    return ops[op] && (ops[op][run.mode] || run.mode === 'batch');
+  });
+  (function next_op() {
+    var op = names.shift();
+    if (!op) {
+      if (!db.close()) fail(db);
+      cleanup();
+      return next_run();
+    }
+    // a batch run of an op without a batch variant is the async one
+    var variant = ops[op][run.mode] || ops[op].async;
+    var res = {db: run.db, size: run.size, threads: run.threads,
+               mode: run.mode, op: op};
+    var spec = variant(db, conf.n, conf.batch);
+    res.handle = db;
+    var done = function() {
+      delete res.handle;
+      next_op();
+    };
+    if (run.mode === 'sync') {
+      runSync(res, spec[0], spec[1], done);
+    } else {
+      runAsync(res, spec[0], spec[2] || target.depth || conf.depth, spec[1],
+               done);
+    }
+  }());
+};
+
+log('Tokyo Cabinet version ' + TC.VERSION);
+setTimeout(next_run, 10);
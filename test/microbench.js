@@ -0,0 +1,22 @@
+// Microbenchmarks of the marshalling layer (see src/bench.cc)
+// Build them with "node-waf configure --bench build" first.
+//
+//  node test/microbench.js [iterations]
+
+var sys = require('sys');
+var bench = require('../build/default/tcbench');
+
+var iter = process.argv[2] ? Number(process.argv[2]) : 100000;
+
+var pad = function(str, len) {
+  str = String(str);
+  while (str.length < len) str = ' ' + str;
+  return str;
+};
+
+sys.puts(pad('case', 38) + pad('ns/op', 10) + pad('allocs/op', 11) +
+         pad('heap B/op', 11));
+bench.run(iter).forEach(function(res) {
+  sys.puts(pad(res.name, 38) + pad(res.ns.toFixed(1), 10) +
+           pad(res.allocs.toFixed(2), 11) + pad(Math.round(res.heap), 11));
+});
@@ -179,6 +179,49 @@ sys.puts("Tokyo Cabinet version " + TC.VERSION);
     }
   });
 
+  sys.puts(JSON.stringify(tdb.get(pk, {columns: ["name", "lang"]})));
+  // a missing record is null, with or without columns
+  if (tdb.get("nosuchkey") !== null ||
+      tdb.get("nosuchkey", {columns: ["name"]}) !== null) {
+    sys.error("get of a missing record is not null");
+  }
+
+  // the same records in one call, the primary key in column ""
+  qry.searchGet({columns: ["name", "age"]}).forEach(function(cols) {
+    sys.puts(cols[""] + "\t" + cols.name + "\t" + cols.age);
+  });
+
+  var agg = qry.aggregate({groupBy: "lang", ops: {n: ["count"], age: ["avg", "age"]}});
+  Object.keys(agg).forEach(function(lang) {
+    sys.puts(lang + "\t" + agg[lang].n + "\t" + agg[lang].age);
+  });
+
+  var prep = tdb.prepare({conds: [["age", QRY.QCNUMGE, "?"]], order: ["name"]});
+  // nothing runs until the parameters are bound
+  try {
+    prep.search();
+    sys.error("search of an unbound query accepted");
+  } catch (e) {
+    sys.puts("search before bind\t" + e.message);
+  }
+  [20, 30, 20].forEach(function(age) {
+    sys.puts(age + "\t" + prep.bind([age]).search().join(","));
+  });
+  // a parameter which is not a String, Number or Buffer is rejected
+  try {
+    prep.bind([true]);
+    sys.error("bind accepted a boolean parameter");
+  } catch (e) {
+    sys.puts("bind([true])\t" + e.message);
+  }
+  // the conditions of a prepared query are fixed by its spec
+  try {
+    prep.addcond("lang", QRY.QCSTROR, "ja");
+    sys.error("addcond of a prepared query accepted");
+  } catch (e) {
+    sys.puts("addcond of a prepared query\t" + e.message);
+  }
+
   if (!tdb.close()) {
     sys.error(tdb.errmsg());
   }
@@ -226,3 +269,33 @@ sys.puts("Tokyo Cabinet version " + TC.VERSION);
   fs.unlink('casket.tcb');
 }());
 
+(function() {
+  sys.puts("== Sample: Binary ==");
+  var HDB = TC.HDB;
+
+  var hdb = new HDB;
+  // values are returned as Buffers
+  hdb.setbinary(true);
+
+  if (!hdb.open('casket.tch', HDB.OWRITER | HDB.OCREAT)) {
+    sys.error(hdb.errmsg());
+  }
+
+  var key = new Buffer([0, 1, 2]);
+  if (!hdb.put(key, new Buffer([0xff, 0, 0xfe]))) {
+    sys.error(hdb.errmsg());
+  }
+
+  var value = hdb.get(key);
+  if (value) {
+    sys.puts(value.length + ':' + value[0] + ',' + value[1] + ',' + value[2]);
+  } else {
+    sys.error(hdb.errmsg());
+  }
+
+  if (!hdb.close()) {
+    sys.error(hdb.errmsg());
+  }
+
+  fs.unlink('casket.tch');
+}());
@@ -0,0 +1,167 @@
+// Multi-core scaling of async methods
+//
+//  node test/scaling.js [--handles=1,2,4,8,16] [--threads=1,2,4,8,16,32]
+//                       [--modes=mutex,serial] [--records=100000]
+//                       [--reads=0.9] [--depth=64] [--seconds=3] [--json]
+//
+// The same async workload (gets and puts of random records, 'reads' of them
+// gets) runs on 1 to n hash databases, each in its own file with 'depth'
+// calls in flight, for each eio thread pool size and for each mode:
+//
+//   mutex   setmutex: reads run in parallel in the thread pool, writes in
+//           a writer lane of each database
+//   serial  setserial: every call runs in a thread of its own database,
+//           without the lock of Tokyo Cabinet (the thread pool is unused)
+//
+// The total operations per second give throughput-vs-cores curves; the
+// speedup is relative to one handle of the same mode and pool size.
+
+var sys = require('sys');
+var TC = require('../build/default/tokyocabinet');
+var fs = require('fs');
+
+var conf = {
+  handles: [1, 2, 4, 8, 16],
+  threads: [1, 2, 4, 8, 16, 32],
+  modes: ['mutex', 'serial'],
+  records: 100000,
+  reads: 0.9,
+  depth: 64,
+  seconds: 3,
+  json: false
+};
+
+process.argv.slice(2).forEach(function(arg) {
+  var m = arg.match(/^--(\w+)(?:=(.*))?$/);
+  if (!m || !(m[1] in conf)) throw 'unknown option ' + arg;
+  var def = conf[m[1]];
+  if (typeof def === 'boolean') {
+    conf[m[1]] = true;
+  } else if (Array.isArray(def)) {
+    conf[m[1]] = m[2].split(',').map(function(v) {
+      return typeof def[0] === 'number' ? Number(v) : v;
+    });
+  } else {
+    conf[m[1]] = Number(m[2]);
+  }
+});
+
+var log = function(str) {
+  if (!conf.json) sys.puts(str);
+};
+
+var key = function(i) {
+  return 'key' + i;
+};
+
+var value = 'val 0123456789abcdef0123456789abcdef0123456789abcdef';
+
+var path = function(i) {
+  return 'scaling.' + i + '.tch';
+};
+
+// one database per handle, loaded once and reopened in each mode
+var load = function(n) {
+  for (var i = 0; i < n; i++) {
+    var db = new TC.HDB;
+    if (!db.open(path(i), TC.HDB.OWRITER | TC.HDB.OCREAT | TC.HDB.OTRUNC)) {
+      throw db.errmsg();
+    }
+    var recs = [];
+    for (var j = 0; j < conf.records; j++) recs.push([key(j), value]);
+    if (!db.putmany(recs, {tx: true})) throw db.errmsg();
+    if (!db.close()) throw db.errmsg();
+  }
+};
+
+var open = function(i, mode) {
+  var db = new TC.HDB;
+  if (mode === 'mutex') {
+    if (!db.setmutex()) throw db.errmsg();
+  } else if (mode === 'serial') {
+    if (!db.setserial()) throw db.errmsg();
+  } else {
+    throw 'unknown mode ' + mode;
+  }
+  if (!db.open(path(i), TC.HDB.OWRITER)) throw db.errmsg();
+  return db;
+};
+
+// keeps depth calls in flight on every database for the given time
+var run = function(mode, handles, threads, done) {
+  TC.setthreads(threads);
+  var dbs = [];
+  for (var i = 0; i < handles; i++) dbs.push(open(i, mode));
+  var ops = 0;
+  var running = 0;
+  var start = Date.now();
+  var end = start + conf.seconds * 1000;
+  var call = function(db) {
+    var k = key(Math.floor(Math.random() * conf.records));
+    var cb = function(e) {
+      if (e) throw db.errmsg(e);
+      ops++;
+      if (Date.now() < end) return call(db);
+      if (--running === 0) finish();
+    };
+    if (Math.random() < conf.reads) {
+      db.getAsync(k, cb);
+    } else {
+      db.putAsync(k, value, cb);
+    }
+  };
+  var finish = function() {
+    var elapsed = Date.now() - start;
+    dbs.forEach(function(db) {
+      if (!db.close()) throw db.errmsg();
+    });
+    done(Math.round(ops / elapsed * 1000));
+  };
+  dbs.forEach(function(db) {
+    for (var j = 0; j < conf.depth; j++) {
+      running++;
+      call(db);
+    }
+  });
+};
+
+var results = [];
+var runs = [];
+conf.modes.forEach(function(mode) {
+  conf.threads.forEach(function(threads) {
+    // the pool size does not matter with setserial
+    if (mode === 'serial' && threads !== conf.threads[0]) return;
+    conf.handles.forEach(function(handles) {
+      runs.push({mode: mode, threads: threads, handles: handles});
+    });
+  });
+});
+
+var maxhandles = Math.max.apply(null, conf.handles);
+var base = {};
+
+log('Tokyo Cabinet version ' + TC.VERSION);
+log('loading ' + maxhandles + ' x ' + conf.records + ' records');
+load(maxhandles);
+
+(function next() {
+  var r = runs.shift();
+  if (!r) {
+    for (var i = 0; i < maxhandles; i++) fs.unlinkSync(path(i));
+    if (conf.json) {
+      sys.puts(JSON.stringify({version: TC.VERSION, conf: conf,
+                               results: results}));
+    }
+    return;
+  }
+  run(r.mode, r.handles, r.threads, function(opsps) {
+    var curve = r.mode + '/' + r.threads;
+    if (!(curve in base)) base[curve] = opsps;
+    r.throughput = opsps;
+    r.speedup = Math.round(opsps / base[curve] * 100) / 100;
+    results.push(r);
+    log(r.mode + ' threads ' + r.threads + ' handles ' + r.handles + ': ' +
+        opsps + ' ops/s (x' + r.speedup + ')');
+    next();
+  });
+}());
@@ -0,0 +1,321 @@
+// YCSB core workloads A-F
+//
+//  node test/ycsb.js [--db=BDB] [--workloads=A,B,C,D,E,F] [--records=100000]
+//                    [--operations=100000] [--concurrency=64]
+//                    [--distribution=zipfian|uniform|latest]
+//                    [--valuesize=1000] [--scanlength=100] [--json]
+//
+//  A: 50% read, 50% update                      (zipfian)
+//  B: 95% read, 5% update                       (zipfian)
+//  C: 100% read                                 (zipfian)
+//  D: 95% read, 5% insert                       (latest)
+//  E: 95% scan, 5% insert                       (zipfian, BDB only)
+//  F: 50% read, 50% read-modify-write           (zipfian)
+//
+// The database is loaded with 'records' records once, then each workload
+// runs 'operations' operations with 'concurrency' async calls in flight.
+// Keys are hashed from the record number as in YCSB, so hot records are
+// spread over the key space instead of being neighbours. --distribution
+// overrides the distribution of every workload.
+
+var sys = require('sys');
+var TC = require('../build/default/tokyocabinet');
+var fs = require('fs');
+
+var conf = {
+  db: 'BDB',
+  workloads: ['A', 'B', 'C', 'D', 'E', 'F'],
+  records: 100000,
+  operations: 100000,
+  concurrency: 64,
+  distribution: '',
+  valuesize: 1000,
+  scanlength: 100,
+  json: false
+};
+
+process.argv.slice(2).forEach(function(arg) {
+  var m = arg.match(/^--(\w+)(?:=(.*))?$/);
+  if (!m || !(m[1] in conf)) throw 'unknown option ' + arg;
+  var def = conf[m[1]];
+  if (typeof def === 'boolean') {
+    conf[m[1]] = true;
+  } else if (Array.isArray(def)) {
+    conf[m[1]] = m[2].split(',');
+  } else if (typeof def === 'number') {
+    conf[m[1]] = Number(m[2]);
+  } else {
+    conf[m[1]] = m[2];
+  }
+});
+
+var workloads = {
+  A: {read: 0.5, update: 0.5, dist: 'zipfian'},
+  B: {read: 0.95, update: 0.05, dist: 'zipfian'},
+  C: {read: 1, dist: 'zipfian'},
+  D: {read: 0.95, insert: 0.05, dist: 'latest'},
+  E: {scan: 0.95, insert: 0.05, dist: 'zipfian'},
+  F: {read: 0.5, rmw: 0.5, dist: 'zipfian'}
+};
+
+// microseconds; Date.now() where process.hrtime is not available
+var clock = process.hrtime ? 'us' : 'ms';
+var now = process.hrtime ? function() {
+  var t = process.hrtime();
+  return t[0] * 1e6 + t[1] / 1e3;
+} : function() {
+  return Date.now() * 1e3;
+};
+
+var log = function(str) {
+  if (!conf.json) sys.puts(str);
+};
+
+// 64-bit FNV-1a of the record number, in two 32-bit halves as numbers
+// are doubles
+var fnvhash = function(num) {
+  var hi = 0xcbf29ce4, lo = 0x84222325;
+  for (var i = 0; i < 8; i++) {
+    lo = (lo ^ (num & 0xff)) >>> 0;
+    num = Math.floor(num / 256);
+    // multiply by the FNV prime 0x100000001b3
+    var l = lo * 0x1b3;
+    var h = hi * 0x1b3 + lo * 0x100 + Math.floor(l / 0x100000000);
+    lo = l >>> 0;
+    hi = h >>> 0;
+  }
+  return [hi, lo];
+};
+
+var hex8 = function(n) {
+  var s = n.toString(16);
+  while (s.length < 8) s = '0' + s;
+  return s;
+};
+
+var key = function(num) {
+  var h = fnvhash(num);
+  return 'user' + hex8(h[0]) + hex8(h[1]);
+};
+
+// Zipfian over [0, items) after Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases", as used by YCSB. Items can be added
+// (for inserts), which updates zeta incrementally.
+var THETA = 0.99;
+
+var Zipfian = function(items) {
+  this.items = 0;
+  this.zetan = 0;
+  this.zeta2 = 1 + Math.pow(0.5, THETA);
+  this.alpha = 1 / (1 - THETA);
+  this.grow(items);
+};
+
+Zipfian.prototype.grow = function(items) {
+  for (var i = this.items; i < items; i++) {
+    this.zetan += 1 / Math.pow(i + 1, THETA);
+  }
+  this.items = items;
+  this.eta = (1 - Math.pow(2 / items, 1 - THETA)) /
+             (1 - this.zeta2 / this.zetan);
+};
+
+Zipfian.prototype.next = function() {
+  var u = Math.random();
+  var uz = u * this.zetan;
+  if (uz < 1) return 0;
+  if (uz < this.zeta2) return 1;
+  return Math.min(this.items - 1, Math.floor(
+      this.items * Math.pow(this.eta * u - this.eta + 1, this.alpha)));
+};
+
+// Record number to read or update. 'zipfian' picks popular records
+// scattered by the hashed keys, 'latest' favours the last inserted.
+var chooser = function(dist, counter) {
+  if (dist === 'uniform') {
+    return function() {
+      return Math.floor(Math.random() * counter.acked);
+    };
+  }
+  var zipf = new Zipfian(counter.acked);
+  if (dist === 'latest') {
+    return function() {
+      if (counter.acked > zipf.items) zipf.grow(counter.acked);
+      return counter.acked - 1 - zipf.next();
+    };
+  }
+  if (dist === 'zipfian') {
+    // drawn over the loaded records, so inserts do not shift the hot set
+    return function() {
+      return zipf.next();
+    };
+  }
+  throw 'unknown distribution ' + dist;
+};
+
+var value = function() {
+  var s = '';
+  while (s.length < conf.valuesize) {
+    s += Math.random().toString(36).slice(2);
+  }
+  return s.slice(0, conf.valuesize);
+};
+
+var percentile = function(lats, p) {
+  return lats.length ?
+    Math.round(lats[Math.min(lats.length - 1, Math.floor(lats.length * p))])
+    : 0;
+};
+
+var open = function() {
+  var DB = TC[conf.db];
+  if (!DB || conf.db === 'FDB' || conf.db === 'TDB' ||
+      conf.db === 'ADB') {
+    throw 'use HDB or BDB';
+  }
+  var db = new DB;
+  if (!db.setmutex()) throw db.errmsg();
+  var path = 'ycsb.' + (conf.db === 'BDB' ? 'tcb' : 'tch');
+  if (!db.open(path, DB.OWRITER | DB.OCREAT | DB.OTRUNC)) {
+    throw db.errmsg();
+  }
+  return db;
+};
+
+var db = open();
+var counter = {acked: conf.records};
+var results = [];
+
+// operations, each calling back once it is done
+var ops = {
+  read: function(pick, cb) {
+    db.getAsync(key(pick()), function(e) {
+      cb(e === TC.HDB.ENOREC ? 0 : e);
+    });
+  },
+  update: function(pick, cb) {
+    db.putAsync(key(pick()), value(), cb);
+  },
+  insert: function(pick, cb) {
+    // acked only when stored, so 'latest' reads no record not yet there
+    var num = counter.inserted++;
+    db.putAsync(key(num), value(), function(e) {
+      if (num >= counter.acked) counter.acked = num + 1;
+      cb(e);
+    });
+  },
+  scan: function(pick, cb) {
+    var len = 1 + Math.floor(Math.random() * conf.scanlength);
+    db.rangeAsync(key(pick()), true, null, true, len, cb);
+  },
+  rmw: function(pick, cb) {
+    var k = key(pick());
+    db.getAsync(k, function(e, val) {
+      if (e && e !== TC.HDB.ENOREC) return cb(e);
+      db.putAsync(k, value(), cb);
+    });
+  }
+};
+
+var load = function(done) {
+  var batch = 1000;
+  var i = 0;
+  var start = now();
+  (function next() {
+    if (i >= conf.records) {
+      log('load: ' + conf.records + ' records in ' +
+          Math.round((now() - start) / 1e3) + ' ms');
+      return done();
+    }
+    var recs = [];
+    for (var j = 0; j < batch && i < conf.records; j++, i++) {
+      recs.push([key(i), value()]);
+    }
+    // one transaction per batch
+    db.putmanyAsync(recs, {tx: true}, function(e) {
+      if (e) throw db.errmsg(e);
+      next();
+    });
+  }());
+};
+
+var run = function(name, done) {
+  var wl = workloads[name];
+  if (!wl) throw 'unknown workload ' + name;
+  if (wl.scan && conf.db !== 'BDB') {
+    log(name + ': skipped, scans need BDB');
+    return done();
+  }
+  counter.inserted = counter.acked;
+  var pick = chooser(conf.distribution || wl.dist, counter);
+  var names = [], limits = [], sum = 0;
+  for (var op in ops) {
+    if (wl[op]) {
+      sum += wl[op];
+      names.push(op);
+      limits.push(sum);
+    }
+  }
+  var lats = {};
+  names.forEach(function(op) { lats[op] = []; });
+  var issued = 0, finished = 0, inflight = 0;
+  var start = now();
+  var issue = function() {
+    while (inflight < conf.concurrency && issued < conf.operations) {
+      var r = Math.random() * sum;
+      var k = 0;
+      while (k < limits.length - 1 && r >= limits[k]) k++;
+      (function(op) {
+        var t = now();
+        inflight++;
+        issued++;
+        ops[op](pick, function(e) {
+          if (e) throw db.errmsg(e);
+          lats[op].push(now() - t);
+          inflight--;
+          if (++finished === conf.operations) {
+            finish();
+          } else {
+            issue();
+          }
+        });
+      }(names[k]));
+    }
+  };
+  var finish = function() {
+    var elapsed = now() - start;
+    var res = {workload: name, distribution: conf.distribution || wl.dist,
+               operations: finished,
+               throughput: Math.round(finished / elapsed * 1e6), ops: {}};
+    log(name + ': ' + res.throughput + ' ops/s');
+    names.forEach(function(op) {
+      var l = lats[op].sort(function(a, b) { return a - b; });
+      res.ops[op] = {count: l.length, p50: percentile(l, 0.5),
+                     p95: percentile(l, 0.95), p99: percentile(l, 0.99),
+                     p999: percentile(l, 0.999)};
+      log('  ' + op + ' ' + l.length + ': p50 ' + res.ops[op].p50 +
+          ' p95 ' + res.ops[op].p95 + ' p99 ' + res.ops[op].p99 +
+          ' p999 ' + res.ops[op].p999);
+    });
+    results.push(res);
+    done();
+  };
+  issue();
+};
+
+log('Tokyo Cabinet version ' + TC.VERSION);
+setTimeout(function() {
+  load(function() {
+    var queue = conf.workloads.slice();
+    (function next() {
+      var name = queue.shift();
+      if (name) return run(name, next);
+      if (!db.close()) throw db.errmsg();
+      fs.unlinkSync('ycsb.' + (conf.db === 'BDB' ? 'tcb' : 'tch'));
+      if (conf.json) {
+        sys.puts(JSON.stringify({version: TC.VERSION, clock: clock,
+                                 conf: conf, results: results}));
+      }
+    }());
+  });
+}, 10);